@@ -16,6 +16,7 @@ Description: This program reads a Brain's Brain board state and generates some n
 #include <unistd.h>
 
 #include "brians_brain.h"
+#include "../damage.h"
 
 int bb_count_live_neighbors(int* pattern, int width, int height, int cell_index) {
     int live_neighbors_count = 0;
@@ -64,6 +65,11 @@ int* bb_gen_next(int* pattern, int board_width,int board_height){
             } else {
                 next_pattern[cell_index] = cell_value;
             }
+
+            // let the draw loop know what to redraw
+            if (next_pattern[cell_index] != cell_value) {
+                damage_mark(cell_index);
+            }
         }
     }
     return next_pattern;
@@ -128,6 +134,7 @@ void bb_add_life(int* pattern, int width, int height, int percent_alive){
         if (pattern[i] == DEAD){
             if (rand() % 100 < percent_alive){
                 pattern[i] = ALIVE;
+                damage_mark(i);
             }
         }
     }
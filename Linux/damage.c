@@ -0,0 +1,74 @@
+/* damage.c
+Tracks which cells changed since the board was last drawn.
+The engines mark cells as a side product of generating the next board,
+and the draw loop takes the list and only redraws those cells.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "damage.h"
+
+static int num_cells = 0;
+static int* changed = NULL; // changed cells, in the order they were marked
+static int num_changed = 0;
+static unsigned char* is_changed = NULL; // so a cell is only listed once
+static bool all_changed = true; // everything needs redrawing
+
+void damage_init(int width, int height) {
+    /* Sets up damage tracking for a width x height board
+    Starts out fully damaged so the first frame draws everything */
+    num_cells = width * height;
+    changed = (int*)malloc(num_cells * sizeof(int));
+    is_changed = (unsigned char*)calloc(num_cells, 1);
+    if (changed == NULL || is_changed == NULL) {
+        perror("Failed to allocate memory for damage tracking");
+        exit(EXIT_FAILURE);
+    }
+    num_changed = 0;
+    all_changed = true;
+}
+
+void damage_mark(int cell) {
+    /* Marks a cell as changed. Does nothing until damage_init is called,
+    so the engines still work on their own */
+    if (is_changed == NULL || all_changed || is_changed[cell]) {
+        return;
+    }
+    is_changed[cell] = 1;
+    changed[num_changed++] = cell;
+}
+
+void damage_all() {
+    /* Marks the whole board as changed */
+    all_changed = true;
+}
+
+bool damage_peek(int** cells, int* count) {
+    /* Same as damage_take, but leaves the list in place */
+    *cells = changed;
+    *count = all_changed ? 0 : num_changed;
+    return all_changed;
+}
+
+bool damage_take(int** cells, int* count) {
+    /* Hands out the changed cells and starts a fresh list. Returns true
+    if the whole board changed, in which case the list is meaningless
+    The list stays valid until the next damage_mark */
+    bool all = all_changed;
+    for (int i = 0; i < num_changed; i++) {
+        is_changed[changed[i]] = 0;
+    }
+    *cells = changed;
+    *count = all ? 0 : num_changed;
+    num_changed = 0;
+    all_changed = false;
+    return all;
+}
+
+void damage_cleanup() {
+    /* Frees the damage tracking */
+    free(changed);
+    free(is_changed);
+    changed = NULL;
+    is_changed = NULL;
+}
@@ -0,0 +1,13 @@
+#ifndef DAMAGE_H
+#define DAMAGE_H
+
+#include <stdbool.h>
+
+void damage_init(int width, int height);
+void damage_mark(int cell);
+void damage_all();
+bool damage_peek(int** cells, int* count);
+bool damage_take(int** cells, int* count);
+void damage_cleanup();
+
+#endif // DAMAGE_H
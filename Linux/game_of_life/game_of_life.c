@@ -15,6 +15,7 @@ Description: This program reads a GoL board state and generates some number of f
 #include <string.h>
 #include <time.h>
 #include "game_of_life.h"
+#include "../damage.h"
 
 // commented out to keep this file as a library
     // can uncomment for testing purposes if needed
@@ -134,6 +135,11 @@ int* gol_gen_next(int* pattern, int width, int height) {
             } else {
                 next_pattern[cell_index] = (live_neighbors == 3);
             }
+
+            // let the draw loop know what to redraw
+            if (next_pattern[cell_index] != pattern[cell_index]) {
+                damage_mark(cell_index);
+            }
         }
     }
 
@@ -205,6 +211,9 @@ void gol_add_life(int* pattern, int width, int height, int percent_alive) {
     for (int i = 0; i < width * height; i++) {
         if (pattern[i] == 0) {
             pattern[i] = (rand() % 100) < percent_alive;
+            if (pattern[i]) {
+                damage_mark(i);
+            }
         }
     }
 }
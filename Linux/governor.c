@@ -0,0 +1,88 @@
+/* governor.c
+Picks how many generations to run per shown frame from what drawing and
+generating actually cost on this machine. Drawing is the expensive part on
+big screens, so running a few generations per frame keeps the simulation at
+its rate while showing fewer frames. Frames can have a budget: when the work
+doesn't fit, first fewer generations get run, then frames are shown less often.
+*/
+#include "governor.h"
+
+#define SMOOTHING 0.1 // weight of the newest measurement
+
+static double gen_period = 100; // ms per generation the simulation should run at
+static double budget = 0; // ms of work allowed per shown frame, 0 for no limit
+static int max_gens = 1;
+
+static double draw_cost = -1; // smoothed ms per frame, -1 until measured
+static double gen_cost = -1; // smoothed ms per generation
+static int gens = 1; // picked for the next frame
+static double period = 100; // ms the next frame is shown for
+
+void governor_setup(float gens_per_sec, float budget_ms, int most_gens) {
+    /* Sets the generation rate to aim for, the work budget per frame
+    and the most generations one frame may run */
+    gen_period = 1000.0 / gens_per_sec;
+    budget = budget_ms;
+    max_gens = most_gens > 0 ? most_gens : 1;
+    draw_cost = gen_cost = -1;
+    gens = 1;
+    period = gen_period;
+}
+
+static double smooth(double average, double sample) {
+    return average < 0 ? sample : average + SMOOTHING * (sample - average);
+}
+
+void governor_update(double draw_ms, double gen_ms, int frame_gens) {
+    /* Takes the time the last frame spent drawing, and running its
+    frame_gens generations, and picks the next frame's generations and period */
+    draw_cost = smooth(draw_cost, draw_ms);
+    gen_cost = smooth(gen_cost, gen_ms / frame_gens);
+
+    // fewest generations per frame that keep up with the generation rate
+    int pace = max_gens;
+    if (gen_cost < gen_period) {
+        double needed = draw_cost / (gen_period - gen_cost);
+        pace = needed < max_gens ? (int)needed : max_gens;
+        if (pace < needed) {
+            pace++;
+        }
+    }
+    // most that fit in the budget
+    int fit = max_gens;
+    if (budget > 0 && gen_cost > 0) {
+        // truncating is fine, anything under one gets clamped to one anyway
+        double room = (budget - draw_cost) / gen_cost;
+        fit = room < max_gens ? (int)room : max_gens;
+    }
+
+    gens = pace < fit ? pace : fit;
+    if (gens > max_gens) {
+        gens = max_gens;
+    }
+    if (gens < 1) {
+        gens = 1;
+    }
+
+    // the frame lasts as long as its generations should, or as long as the work takes
+    double work = draw_cost + gens * gen_cost;
+    period = gens * gen_period;
+    if (work > period) {
+        period = work;
+    }
+    // still over budget with one generation, so show frames less often
+    // until the work is back to the budget's share of each frame
+    if (budget > 0 && work > budget) {
+        period *= work / budget;
+    }
+}
+
+int governor_gens() {
+    /* Generations to run before the next frame */
+    return gens;
+}
+
+long governor_period_ns() {
+    /* How long the next frame should be shown */
+    return (long)(period * 1000000);
+}
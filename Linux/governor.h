@@ -0,0 +1,9 @@
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+
+void governor_setup(float gens_per_sec, float budget_ms, int max_gens);
+void governor_update(double draw_ms, double gen_ms, int gens);
+int governor_gens();
+long governor_period_ns();
+
+#endif // GOVERNOR_H
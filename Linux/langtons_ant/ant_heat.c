@@ -0,0 +1,179 @@
+/* ant_heat.c
+Trail-age heatmap for Langton's Ant.
+Every screen cell remembers the generation an ant last visited it, and its
+shade is how many fade periods have passed since then (0 is hottest).
+Instead of decaying every cell every generation, each visited cell sits in
+a bucket queue keyed on the generation its shade next changes, so a tick
+only touches cells whose shade actually changes. Those cells are collected
+in a dirty list for the draw loop.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ant_heat.h"
+
+// A cell waiting for its next shade change, stamp is the visit it belongs to
+typedef struct {
+    int cell;
+    unsigned int stamp;
+} HeatEntry;
+
+typedef struct {
+    HeatEntry* entries;
+    int count, capacity;
+} Bucket;
+
+static int width, height;
+static int num_shades; // shade num_shades-1 is fully faded
+static int period; // generations per shade step
+static unsigned int now = 1; // current generation, 0 means never visited
+static unsigned int* last_visit;
+static unsigned char* shades;
+
+// Ring of period+1 buckets, bucket t % num_buckets holds cells due at t
+static Bucket* buckets;
+static int num_buckets;
+
+// Cells whose shade changed (or that an ant walked over) since the last draw
+static int* dirty;
+static int num_dirty;
+static unsigned char* is_dirty;
+
+static void* alloc_or_die(size_t size) {
+    void* ptr = calloc(1, size);
+    if (ptr == NULL) {
+        perror("Failed to allocate memory for heatmap");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+static void push(Bucket* bucket, int cell, unsigned int stamp) {
+    /* Adds a cell to a bucket, growing it if needed */
+    if (bucket->count == bucket->capacity) {
+        bucket->capacity = bucket->capacity ? bucket->capacity * 2 : 64;
+        bucket->entries = (HeatEntry*)realloc(bucket->entries, bucket->capacity * sizeof(HeatEntry));
+        if (bucket->entries == NULL) {
+            perror("Failed to allocate memory for heatmap bucket");
+            exit(EXIT_FAILURE);
+        }
+    }
+    bucket->entries[bucket->count++] = (HeatEntry){cell, stamp};
+}
+
+static void mark_dirty(int cell) {
+    if (!is_dirty[cell]) {
+        is_dirty[cell] = 1;
+        dirty[num_dirty++] = cell;
+    }
+}
+
+void heat_init(int inp_width, int inp_height, int fade_gens, int inp_num_shades) {
+    /* Sets up a heatmap for a width x height screen. Cells fade from
+    shade 0 to shade num_shades-1 over roughly fade_gens generations */
+    width = inp_width;
+    height = inp_height;
+    num_shades = inp_num_shades;
+    period = fade_gens / (num_shades - 1);
+    if (period < 1) {
+        period = 1;
+    }
+
+    last_visit = (unsigned int*)alloc_or_die(width * height * sizeof(unsigned int));
+    shades = (unsigned char*)alloc_or_die(width * height);
+    memset(shades, num_shades - 1, width * height);
+
+    num_buckets = period + 1;
+    buckets = (Bucket*)alloc_or_die(num_buckets * sizeof(Bucket));
+
+    dirty = (int*)alloc_or_die(width * height * sizeof(int));
+    is_dirty = (unsigned char*)alloc_or_die(width * height);
+    num_dirty = 0;
+}
+
+void heat_tick() {
+    /* Advances to the next generation and refreshes the shades that
+    are due. Cells get rescheduled one period later until fully faded */
+    now++;
+    Bucket* due = &buckets[now % num_buckets];
+    Bucket* later = &buckets[(now + period) % num_buckets];
+
+    for (int i = 0; i < due->count; i++) {
+        HeatEntry entry = due->entries[i];
+        // stale entry, the cell was visited again since
+        if (last_visit[entry.cell] != entry.stamp) {
+            continue;
+        }
+
+        int shade = (now - entry.stamp) / period;
+        if (shade > num_shades - 1) {
+            shade = num_shades - 1;
+        }
+        if (shade != shades[entry.cell]) {
+            shades[entry.cell] = shade;
+            mark_dirty(entry.cell);
+        }
+        if (shade < num_shades - 1) {
+            push(later, entry.cell, entry.stamp);
+        }
+    }
+    due->count = 0;
+}
+
+void heat_visit(int x, int y) {
+    /* Records an ant on screen cell x, y this generation */
+    if (x < 0 || x >= width || y < 0 || y >= height) {
+        return;
+    }
+    int cell = y * width + x;
+
+    // always redraw, the ant was drawn on top of this cell
+    mark_dirty(cell);
+    if (last_visit[cell] == now) {
+        return;
+    }
+
+    last_visit[cell] = now;
+    shades[cell] = 0;
+    push(&buckets[(now + period) % num_buckets], cell, now);
+}
+
+int heat_shade(int cell) {
+    /* Returns the shade of a cell, 0 is hottest */
+    return shades[cell];
+}
+
+int heat_take_dirty(int** cells) {
+    /* Hands out the cells to redraw since the last call and resets the list
+    The list stays valid until the next heat_tick or heat_visit */
+    for (int i = 0; i < num_dirty; i++) {
+        is_dirty[dirty[i]] = 0;
+    }
+    *cells = dirty;
+    int count = num_dirty;
+    num_dirty = 0;
+    return count;
+}
+
+void heat_reset() {
+    /* Forgets every visit, all cells go back to fully faded */
+    memset(last_visit, 0, width * height * sizeof(unsigned int));
+    memset(shades, num_shades - 1, width * height);
+    for (int i = 0; i < num_buckets; i++) {
+        buckets[i].count = 0;
+    }
+    memset(is_dirty, 0, width * height);
+    num_dirty = 0;
+}
+
+void heat_cleanup() {
+    /* Frees the heatmap */
+    for (int i = 0; i < num_buckets; i++) {
+        free(buckets[i].entries);
+    }
+    free(buckets);
+    free(last_visit);
+    free(shades);
+    free(dirty);
+    free(is_dirty);
+}
@@ -0,0 +1,12 @@
+#ifndef ANT_HEAT_H
+#define ANT_HEAT_H
+
+void heat_init(int width, int height, int fade_gens, int num_shades);
+void heat_tick();
+void heat_visit(int x, int y);
+int heat_shade(int cell);
+int heat_take_dirty(int** cells);
+void heat_reset();
+void heat_cleanup();
+
+#endif // ANT_HEAT_H
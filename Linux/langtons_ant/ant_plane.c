@@ -0,0 +1,171 @@
+/* ant_plane.c
+Unbounded plane for Langton's Ant.
+Cells live in fixed-size tiles that are only allocated once an ant
+writes into them, and the tiles are kept in a hash map keyed on their
+tile coordinates. Reading a cell nobody has touched yet gives state 0.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ant_plane.h"
+
+#define INITIAL_BUCKETS 64
+
+static size_t hash_tile(int tx, int ty, size_t num_buckets) {
+    /* Hashes tile coordinates into a bucket index */
+    unsigned int h = (unsigned int)tx * 73856093u ^ (unsigned int)ty * 19349663u;
+    return (h ^ (h >> 15)) & (num_buckets - 1);
+}
+
+static Tile* find_tile(Plane* plane, int tx, int ty) {
+    /* Returns the tile at tx, ty or NULL if it was never allocated */
+    if (plane->last && plane->last->tx == tx && plane->last->ty == ty) {
+        return plane->last;
+    }
+
+    Tile* tile = plane->buckets[hash_tile(tx, ty, plane->num_buckets)];
+    while (tile && (tile->tx != tx || tile->ty != ty)) {
+        tile = tile->next;
+    }
+    if (tile) {
+        plane->last = tile;
+    }
+    return tile;
+}
+
+static void grow_buckets(Plane* plane) {
+    /* Doubles the bucket count and rehashes every tile */
+    size_t num_buckets = plane->num_buckets * 2;
+    Tile** buckets = (Tile**)calloc(num_buckets, sizeof(Tile*));
+    if (buckets == NULL) {
+        perror("Failed to allocate memory for plane buckets");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < plane->num_buckets; i++) {
+        Tile* tile = plane->buckets[i];
+        while (tile) {
+            Tile* next = tile->next;
+            size_t index = hash_tile(tile->tx, tile->ty, num_buckets);
+            tile->next = buckets[index];
+            buckets[index] = tile;
+            tile = next;
+        }
+    }
+
+    free(plane->buckets);
+    plane->buckets = buckets;
+    plane->num_buckets = num_buckets;
+}
+
+Plane* plane_create() {
+    /* Creates an empty plane on the heap, free with plane_free */
+    Plane* plane = (Plane*)malloc(sizeof(Plane));
+    if (plane == NULL) {
+        perror("Failed to allocate memory for plane");
+        exit(EXIT_FAILURE);
+    }
+    plane->num_buckets = INITIAL_BUCKETS;
+    plane->num_tiles = 0;
+    plane->last = NULL;
+    plane->buckets = (Tile**)calloc(plane->num_buckets, sizeof(Tile*));
+    if (plane->buckets == NULL) {
+        perror("Failed to allocate memory for plane buckets");
+        exit(EXIT_FAILURE);
+    }
+    return plane;
+}
+
+void plane_clear(Plane* plane) {
+    /* Frees every tile, leaving an all-zero plane */
+    for (size_t i = 0; i < plane->num_buckets; i++) {
+        Tile* tile = plane->buckets[i];
+        while (tile) {
+            Tile* next = tile->next;
+            free(tile);
+            tile = next;
+        }
+        plane->buckets[i] = NULL;
+    }
+    plane->num_tiles = 0;
+    plane->last = NULL;
+}
+
+void plane_free(Plane* plane) {
+    /* Frees the plane and all of its tiles */
+    if (plane == NULL) {
+        return;
+    }
+    plane_clear(plane);
+    free(plane->buckets);
+    free(plane);
+}
+
+unsigned char* plane_cell(Plane* plane, int x, int y) {
+    /* Returns a pointer to the cell at x, y, allocating its tile if needed */
+    int tx = x >> TILE_SHIFT;
+    int ty = y >> TILE_SHIFT;
+
+    Tile* tile = find_tile(plane, tx, ty);
+    if (tile == NULL) {
+        // keep the load factor at or below 1
+        if (plane->num_tiles >= plane->num_buckets) {
+            grow_buckets(plane);
+        }
+
+        tile = (Tile*)calloc(1, sizeof(Tile));
+        if (tile == NULL) {
+            perror("Failed to allocate memory for plane tile");
+            exit(EXIT_FAILURE);
+        }
+        tile->tx = tx;
+        tile->ty = ty;
+
+        size_t index = hash_tile(tx, ty, plane->num_buckets);
+        tile->next = plane->buckets[index];
+        plane->buckets[index] = tile;
+        plane->num_tiles++;
+        plane->last = tile;
+    }
+
+    return &tile->cells[(y & TILE_MASK) * TILE_SIZE + (x & TILE_MASK)];
+}
+
+unsigned char plane_peek(Plane* plane, int x, int y) {
+    /* Returns the state of the cell at x, y without allocating anything */
+    Tile* tile = find_tile(plane, x >> TILE_SHIFT, y >> TILE_SHIFT);
+    if (tile == NULL) {
+        return 0;
+    }
+    return tile->cells[(y & TILE_MASK) * TILE_SIZE + (x & TILE_MASK)];
+}
+
+void plane_blit(Plane* plane, int* grid, int width, int height, int origin_x, int origin_y) {
+    /* Copies the width x height window of the plane starting at
+    origin_x, origin_y into grid. Looks each tile up once per row */
+    for (int y = 0; y < height; y++) {
+        int py = origin_y + y;
+        int* row = grid + y * width;
+
+        int x = 0;
+        while (x < width) {
+            int px = origin_x + x;
+            // number of cells left in this tile's row, capped by the window
+            int run = TILE_SIZE - (px & TILE_MASK);
+            if (run > width - x) {
+                run = width - x;
+            }
+
+            Tile* tile = find_tile(plane, px >> TILE_SHIFT, py >> TILE_SHIFT);
+            if (tile == NULL) {
+                memset(row + x, 0, run * sizeof(int));
+            } else {
+                unsigned char* cells = &tile->cells[(py & TILE_MASK) * TILE_SIZE + (px & TILE_MASK)];
+                for (int i = 0; i < run; i++) {
+                    row[x + i] = cells[i];
+                }
+            }
+            x += run;
+        }
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef ANT_PLANE_H
+#define ANT_PLANE_H
+
+#include <stddef.h>
+
+// Tiles are TILE_SIZE x TILE_SIZE cells, TILE_SIZE must be a power of two
+#define TILE_SHIFT 6
+#define TILE_SIZE (1 << TILE_SHIFT)
+#define TILE_MASK (TILE_SIZE - 1)
+
+// One block of cell states, allocated the first time an ant writes into it
+typedef struct Tile {
+    int tx, ty; // tile coordinates (cell coordinates >> TILE_SHIFT)
+    struct Tile* next; // next tile in the same hash bucket
+    unsigned char cells[TILE_SIZE * TILE_SIZE];
+} Tile;
+
+// Sparse plane of cells, stored as a hash map of tiles
+// Memory grows with the area the ants have visited, not with the screen
+typedef struct Plane {
+    Tile** buckets;
+    size_t num_buckets; // always a power of two
+    size_t num_tiles;
+    Tile* last; // most recently used tile, ants tend to stay in one for a while
+} Plane;
+
+Plane* plane_create();
+void plane_free(Plane* plane);
+void plane_clear(Plane* plane);
+unsigned char* plane_cell(Plane* plane, int x, int y);
+unsigned char plane_peek(Plane* plane, int x, int y);
+void plane_blit(Plane* plane, int* grid, int width, int height, int origin_x, int origin_y);
+
+#endif // ANT_PLANE_H
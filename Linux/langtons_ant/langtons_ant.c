@@ -12,53 +12,208 @@ Langton's ant
 #include <string.h>
 #include <stdlib.h>
 #include "langtons_ant.h"
+#include "ant_plane.h"
+#include "../damage.h"
 
 // Globals to let this be imported as the others are
 static int num_ants;
 static Ant* ants;
-static char* ruleset;
 
-int* ant_gen_next(int* grid, int width, int height) {
+// Transition table, indexed by state * num_colors + cell color
+// Plain Langton's ants are just turmites with a single state
+static AntRule* rules = NULL;
+static AntRule* ruleset_rules = NULL; // table built by init_ants, owned here
+static int num_states;
+static int num_colors;
+static int steps_per_gen = 1; // ant steps taken each time ant_gen_next is called
+static void (*visit_hook)(int, int) = NULL; // told about every cell an ant leaves
+
+// Wrapped ants step on a dense byte per screen cell. Unbounded ones live on
+// a sparse plane instead, so they only pay for what they visit
+static unsigned char* wrapped = NULL;
+static int wrapped_cells = 0;
+static Plane* plane = NULL;
+static bool unbounded = false; // don't wrap around the screen edges
+static bool follow = false; // keep the viewport centered on the ants
+static int origin_x = 0, origin_y = 0; // plane coordinates of the top left cell on screen
+
+static void follow_ants(int width, int height) {
+    /* Recenters the viewport on the ants' centroid once it leaves
+    the middle half of the screen, so the view doesn't jitter every step */
+    long long sum_x = 0, sum_y = 0;
     for (int i = 0; i < num_ants; i++) {
-        int current_index = ants[i].y * width + ants[i].x;
-        char current_rule = ruleset[grid[current_index]];
-        
-        // Update grid state
-        grid[current_index] = (grid[current_index] + 1) % strlen(ruleset);
-        
-        // Update direction
-        if (current_rule == 'L') {
-            ants[i].direction = (ants[i].direction + 3) % NUM_DIRS;
-        } else if (current_rule == 'R') {
-            ants[i].direction = (ants[i].direction + 1) % NUM_DIRS;
-        } else if (current_rule == 'U') {
-            ants[i].direction = (ants[i].direction + 2) % NUM_DIRS;
+        sum_x += ants[i].x;
+        sum_y += ants[i].y;
+    }
+    int center_x = sum_x / num_ants;
+    int center_y = sum_y / num_ants;
+
+    if (center_x < origin_x + width / 4 || center_x >= origin_x + width - width / 4 ||
+        center_y < origin_y + height / 4 || center_y >= origin_y + height - height / 4) {
+        origin_x = center_x - width / 2;
+        origin_y = center_y - height / 2;
+    }
+}
+
+int* ant_gen_next(int* grid, int width, int height) {
+    /* Steps every ant steps_per_gen times and returns the screen as a new
+    grid. The old grid is left untouched. Wrapped ants patch the cells they
+    write into a copy of it, unbounded ones get the viewport blitted from
+    the plane */
+    int* new_grid = (int*)malloc(width * height * sizeof(int));
+    if (!unbounded) {
+        if (wrapped == NULL) {
+            wrapped_cells = width * height;
+            wrapped = (unsigned char*)calloc(wrapped_cells, 1);
+            // ants from a file can start off screen, bring them on
+            for (int i = 0; i < num_ants; i++) {
+                ants[i].x = (ants[i].x % width + width) % width;
+                ants[i].y = (ants[i].y % height + height) % height;
+            }
         }
-        
-        // Move ant
-        switch(ants[i].direction) {
-            case UP: ants[i].y--; break;
-            case RIGHT: ants[i].x++; break;
-            case DOWN: ants[i].y++; break;
-            case LEFT: ants[i].x--; break;
-            default:
-                fprintf(stderr, "Invalid direction\n");
-                exit(1);
+        memcpy(new_grid, grid, width * height * sizeof(int));
+    }
+
+    for (int step = 0; step < steps_per_gen; step++) {
+        for (int i = 0; i < num_ants; i++) {
+            unsigned char* cell = unbounded ? plane_cell(plane, ants[i].x, ants[i].y)
+                                            : &wrapped[ants[i].y * width + ants[i].x];
+            AntRule rule = rules[ants[i].state * num_colors + *cell];
+            if (visit_hook) {
+                visit_hook(ants[i].x, ants[i].y);
+            }
+
+            // the cell changes and the ant leaves it, so it needs redrawing
+            int screen_x = ants[i].x - origin_x;
+            int screen_y = ants[i].y - origin_y;
+            if (screen_x >= 0 && screen_x < width && screen_y >= 0 && screen_y < height) {
+                damage_mark(screen_y * width + screen_x);
+            }
+
+            // Update grid state, direction and ant state from the table
+            *cell = rule.write;
+            if (!unbounded) {
+                new_grid[ants[i].y * width + ants[i].x] = rule.write;
+            }
+            ants[i].direction = (ants[i].direction + rule.turn) % NUM_DIRS;
+            ants[i].state = rule.next;
+
+            // Move ant
+            switch(ants[i].direction) {
+                case UP: ants[i].y--; break;
+                case RIGHT: ants[i].x++; break;
+                case DOWN: ants[i].y++; break;
+                case LEFT: ants[i].x--; break;
+                default:
+                    fprintf(stderr, "Invalid direction\n");
+                    exit(1);
+            }
+
+            // Wrap around edges
+            if (!unbounded) {
+                ants[i].x = (ants[i].x + width) % width;
+                ants[i].y = (ants[i].y + height) % height;
+            }
         }
-        
-        // Wrap around edges
-        ants[i].x = (ants[i].x + width) % width;
-        ants[i].y = (ants[i].y + height) % height;
     }
-    int* new_grid = (int*)malloc(width * height * sizeof(int));
-    memcpy(new_grid, grid, width * height * sizeof(int));
+
+    if (follow) {
+        int old_x = origin_x, old_y = origin_y;
+        follow_ants(width, height);
+        if (origin_x != old_x || origin_y != old_y) {
+            damage_all();
+        }
+    }
+
+    if (unbounded) {
+        plane_blit(plane, new_grid, width, height, origin_x, origin_y);
+    }
     return new_grid;
 }
 
-void init_ants(Ant* inp_ants, int inp_num_ants, char* inp_ruleset) {
+int ant_turn_from_rule(char rule) {
+    /* Converts a ruleset letter into clockwise quarter turns
+    R:RIGHT, L:LEFT, C:CONTINUE, U:U-TURN. Returns -1 for anything else */
+    switch (rule) {
+        case 'C': return 0;
+        case 'R': return 1;
+        case 'U': return 2;
+        case 'L': return 3;
+        default: return -1;
+    }
+}
+
+void init_turmites(Ant* inp_ants, int inp_num_ants, AntRule* table, int inp_num_states, int inp_num_colors) {
+    /* Sets up the ants to step through a turmite transition table
+    The table is borrowed, keep it alive while the ants run */
     ants = inp_ants;
     num_ants = inp_num_ants;
-    ruleset = inp_ruleset;
+    rules = table;
+    num_states = inp_num_states;
+    num_colors = inp_num_colors;
+}
+
+void init_ants(Ant* inp_ants, int inp_num_ants, char* inp_ruleset) {
+    /* Sets up plain Langton's ants by turning the ruleset into a
+    single state table where color c always becomes color c+1 */
+    int inp_num_colors = strlen(inp_ruleset);
+    free(ruleset_rules);
+    ruleset_rules = (AntRule*)malloc(inp_num_colors * sizeof(AntRule));
+    for (int c = 0; c < inp_num_colors; c++) {
+        int turn = ant_turn_from_rule(inp_ruleset[c]);
+        ruleset_rules[c].write = (c + 1) % inp_num_colors;
+        ruleset_rules[c].turn = turn < 0 ? 0 : turn; // unknown rules just continue, like before
+        ruleset_rules[c].next = 0;
+    }
+    init_turmites(inp_ants, inp_num_ants, ruleset_rules, 1, inp_num_colors);
+}
+
+void ant_set_steps(int steps) {
+    /* Sets how many steps each ant takes per generation */
+    steps_per_gen = steps > 0 ? steps : 1;
+}
+
+void ant_set_unbounded(bool inp_follow) {
+    /* Lets the ants walk off the screen instead of wrapping.
+    If inp_follow is set, the viewport tracks the ants' centroid,
+    otherwise it stays where the screen started */
+    unbounded = true;
+    follow = inp_follow;
+    if (plane == NULL) {
+        plane = plane_create();
+    }
+}
+
+void ant_set_visit_hook(void (*hook)(int x, int y)) {
+    /* Registers a function called with the plane coordinates of
+    every cell an ant steps off of. NULL turns it off */
+    visit_hook = hook;
+}
+
+void ant_viewport(int* x, int* y) {
+    /* Gives the plane coordinates of the top left cell on screen */
+    *x = origin_x;
+    *y = origin_y;
+}
+
+void ant_clear() {
+    /* Resets every cell back to state 0 */
+    if (plane) {
+        plane_clear(plane);
+    }
+    if (wrapped) {
+        memset(wrapped, 0, wrapped_cells);
+    }
+}
+
+void ant_cleanup() {
+    /* Frees the cells and the ruleset table */
+    plane_free(plane);
+    plane = NULL;
+    free(wrapped);
+    wrapped = NULL;
+    free(ruleset_rules);
+    ruleset_rules = NULL;
 }
 
 void ant_add_life(int* pattern, int width, int height, int percent_alive) {
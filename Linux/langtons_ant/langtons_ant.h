@@ -1,6 +1,8 @@
 #ifndef LANGTONS_ANT_H
 #define LANGTONS_ANT_H
 
+#include <stdbool.h>
+
 typedef enum {
     UP,
     RIGHT,
@@ -25,11 +27,27 @@ typedef struct {
     int y;
     Direction direction; // 0:UP, 1:RIGHT, 2:DOWN, 3:LEFT
     ARGB color;
+    int state; // turmite state, always 0 for plain Langton's ants
 } Ant;
 
+// One (cell color, ant state) entry of a turmite transition table
+typedef struct {
+    unsigned char write; // color left in the cell
+    unsigned char turn; // how far to turn clockwise, in quarter turns
+    unsigned char next; // state the ant switches to
+} AntRule;
+
 int* ant_gen_next(int* grid, int width, int height);
 void ant_add_life(int* pattern, int width, int height, int percent_alive);
 int* ant_gen_random(int width, int height, int percent_alive);
 void init_ants(Ant* inp_ants, int num_ants, char* ruleset);
+void init_turmites(Ant* inp_ants, int num_ants, AntRule* table, int num_states, int num_colors);
+int ant_turn_from_rule(char rule);
+void ant_set_steps(int steps);
+void ant_set_unbounded(bool follow);
+void ant_set_visit_hook(void (*hook)(int x, int y));
+void ant_viewport(int* x, int* y);
+void ant_clear();
+void ant_cleanup();
 
 #endif
\ No newline at end of file
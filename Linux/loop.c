@@ -0,0 +1,72 @@
+/* loop.c
+One epoll loop for everything simwall waits on. Each file descriptor
+(the X connection, the frame timer, signals, whatever comes later) gets a
+handler, and the process sleeps until one of them has something. Nothing
+ready means no CPU used at all.
+*/
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include "loop.h"
+
+typedef struct Entry {
+    int fd; // -1 for a free entry
+    LoopHandler handler;
+} Entry;
+
+static int epoll_fd = -1;
+static Entry entries[LOOP_MAX_HANDLERS];
+
+bool loop_setup() {
+    /* Creates the epoll instance. Returns false if it couldn't */
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    for (int i = 0; i < LOOP_MAX_HANDLERS; i++) {
+        entries[i].fd = -1;
+    }
+    return epoll_fd >= 0;
+}
+
+bool loop_add(int fd, LoopHandler handler) {
+    /* Calls handler whenever fd becomes readable. Returns false if the
+    table is full or epoll won't take it */
+    for (int i = 0; i < LOOP_MAX_HANDLERS; i++) {
+        if (entries[i].fd >= 0) {
+            continue;
+        }
+        struct epoll_event event = {.events = EPOLLIN, .data.ptr = &entries[i]};
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            return false;
+        }
+        entries[i] = (Entry){fd, handler};
+        return true;
+    }
+    return false;
+}
+
+void loop_remove(int fd) {
+    /* Stops watching fd, it's up to the caller to close it */
+    for (int i = 0; i < LOOP_MAX_HANDLERS; i++) {
+        if (entries[i].fd == fd) {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+            entries[i].fd = -1;
+        }
+    }
+}
+
+void loop_wait() {
+    /* Sleeps until at least one fd is ready, then runs their handlers */
+    struct epoll_event events[LOOP_MAX_HANDLERS];
+    int count = epoll_wait(epoll_fd, events, LOOP_MAX_HANDLERS, -1);
+    if (count < 0 && errno != EINTR) {
+        perror("epoll_wait");
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        Entry* entry = (Entry*)events[i].data.ptr;
+        // an earlier handler this round may have removed it
+        if (entry->fd >= 0) {
+            entry->handler(entry->fd);
+        }
+    }
+}
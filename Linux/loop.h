@@ -0,0 +1,15 @@
+#ifndef LOOP_H
+#define LOOP_H
+
+#include <stdbool.h>
+
+#define LOOP_MAX_HANDLERS 16
+
+typedef void (*LoopHandler)(int fd);
+
+bool loop_setup();
+bool loop_add(int fd, LoopHandler handler);
+void loop_remove(int fd);
+void loop_wait();
+
+#endif // LOOP_H
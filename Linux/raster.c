@@ -0,0 +1,288 @@
+/* raster.c
+Turns a whole board of cell states into framebuffer pixels.
+Each cell is a palette lookup widened into a size x size block, so the
+frame is split into bands of cell rows that worker threads fill at the
+same time. With SSSE3, small palettes are looked up four cells at a time
+with a byte shuffle. Common cell sizes get their own unrolled expanders.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "raster.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <tmmintrin.h>
+#define RASTER_X86
+#endif
+
+// What to draw, shared by every thread for one raster_board call
+typedef struct RasterJob {
+    const int* cells;
+    int board_width, board_height;
+    const unsigned int* palette;
+    int num_colors;
+    size_t size;
+    unsigned int* pixels;
+    int stride; // pixels per framebuffer row
+    int width, height; // framebuffer size, the board gets clipped to it
+} RasterJob;
+
+static int num_threads = 0; // including the calling thread
+static pthread_t workers[RASTER_MAX_THREADS];
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t job_done = PTHREAD_COND_INITIALIZER;
+static RasterJob job;
+static unsigned long job_id = 0; // bumped for every job so workers see new ones
+static unsigned long start_id = 0; // job_id when the workers were started
+static int bands_left = 0;
+static bool quitting = false;
+static bool use_ssse3 = false;
+
+/* Row expanders write count whole cells of one row as size wide pixel
+runs. The bodies are always inlined into wrappers with a constant size for
+the common cell sizes, so the inner loops unroll into straight stores */
+typedef void (*ExpandFunc)(const int* cells, int count, const RasterJob* r, unsigned int* out);
+
+static inline __attribute__((always_inline))
+void expand_scalar(const int* cells, int count, const RasterJob* r, unsigned int* out, size_t size) {
+    for (int i = 0; i < count; i++) {
+        unsigned int pixel = r->palette[cells[i] % r->num_colors];
+        for (size_t j = 0; j < size; j++) {
+            out[j] = pixel;
+        }
+        out += size;
+    }
+}
+
+#ifdef RASTER_X86
+static inline __attribute__((always_inline, target("ssse3")))
+void expand_ssse3(const int* cells, int count, const RasterJob* r, unsigned int* out, size_t size) {
+    /* For palettes of up to four colors. The palette sits in one register
+    and pshufb picks four pixels out of it per four cells, which then get
+    broadcast across their cells */
+    unsigned int table[4] = {0};
+    memcpy(table, r->palette, r->num_colors * sizeof(unsigned int));
+    __m128i palette = _mm_loadu_si128((const __m128i*)table);
+    // copies the low byte of each lane across the lane, then offsets it
+    const __m128i spread = _mm_setr_epi8(0, 0, 0, 0, 4, 4, 4, 4, 8, 8, 8, 8, 12, 12, 12, 12);
+    const __m128i offsets = _mm_setr_epi8(0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i states = _mm_loadu_si128((const __m128i*)(cells + i));
+        __m128i bytes = _mm_add_epi8(_mm_shuffle_epi8(_mm_slli_epi32(states, 2), spread), offsets);
+        __m128i quad = _mm_shuffle_epi8(palette, bytes);
+
+        if (size == 1) {
+            _mm_storeu_si128((__m128i*)out, quad);
+            out += 4;
+            continue;
+        }
+        __m128i lanes[4] = {
+            _mm_shuffle_epi32(quad, 0x00), _mm_shuffle_epi32(quad, 0x55),
+            _mm_shuffle_epi32(quad, 0xaa), _mm_shuffle_epi32(quad, 0xff)
+        };
+        for (int k = 0; k < 4; k++) {
+            size_t j = 0;
+            for (; j + 4 <= size; j += 4) {
+                _mm_storeu_si128((__m128i*)(out + j), lanes[k]);
+            }
+            for (; j < size; j++) {
+                out[j] = _mm_cvtsi128_si32(lanes[k]);
+            }
+            out += size;
+        }
+    }
+    expand_scalar(cells + i, count - i, r, out, size);
+}
+
+#define SSSE3_EXPANDER(N) \
+    __attribute__((target("ssse3"))) \
+    static void expand_ssse3_##N(const int* cells, int count, const RasterJob* r, unsigned int* out) { \
+        expand_ssse3(cells, count, r, out, N); \
+    }
+#define SSSE3_ENTRY(N) expand_ssse3_##N
+#else
+#define SSSE3_EXPANDER(N)
+#define SSSE3_ENTRY(N) NULL
+#endif
+
+#define EXPANDER(N) \
+    static void expand_scalar_##N(const int* cells, int count, const RasterJob* r, unsigned int* out) { \
+        expand_scalar(cells, count, r, out, N); \
+    } \
+    SSSE3_EXPANDER(N)
+
+EXPANDER(1) EXPANDER(2) EXPANDER(3) EXPANDER(4) EXPANDER(5)
+EXPANDER(8) EXPANDER(10) EXPANDER(16) EXPANDER(25) EXPANDER(32)
+
+// generic fallbacks for any other cell size
+static void expand_scalar_any(const int* cells, int count, const RasterJob* r, unsigned int* out) {
+    expand_scalar(cells, count, r, out, r->size);
+}
+#ifdef RASTER_X86
+__attribute__((target("ssse3")))
+static void expand_ssse3_any(const int* cells, int count, const RasterJob* r, unsigned int* out) {
+    expand_ssse3(cells, count, r, out, r->size);
+}
+#endif
+
+#define ENTRY(N) {N, expand_scalar_##N, SSSE3_ENTRY(N)}
+static const struct {
+    size_t size;
+    ExpandFunc scalar, ssse3;
+} expanders[] = {
+    ENTRY(1), ENTRY(2), ENTRY(3), ENTRY(4), ENTRY(5),
+    ENTRY(8), ENTRY(10), ENTRY(16), ENTRY(25), ENTRY(32)
+};
+
+// expanders picked by raster_setup for its cell size
+static size_t expand_size = 0;
+static ExpandFunc expand_row_scalar = expand_scalar_any;
+static ExpandFunc expand_row_ssse3 = SSSE3_ENTRY(any);
+
+static void raster_band(const RasterJob* r, int band, int bands) {
+    /* Draws this band's share of cell rows. Each cell row is expanded
+    into one pixel row, then copied down the rest of the cell height */
+    int rows = (r->height + r->size - 1) / r->size;
+    if (rows > r->board_height) {
+        rows = r->board_height;
+    }
+    int row0 = rows * band / bands, row1 = rows * (band + 1) / bands;
+
+    // cells that fit entirely, then the one the right edge cuts through
+    int whole = r->width / r->size;
+    if (whole > r->board_width) {
+        whole = r->board_width;
+    }
+    int edge = r->width - whole * r->size;
+
+    // a size raster_setup didn't pick for gets the generic expanders
+    bool specialized = r->size == expand_size;
+    ExpandFunc expand = specialized ? expand_row_scalar : expand_scalar_any;
+#ifdef RASTER_X86
+    if (use_ssse3 && r->num_colors <= 4) {
+        expand = specialized ? expand_row_ssse3 : expand_ssse3_any;
+    }
+#endif
+
+    for (int y = row0; y < row1; y++) {
+        const int* cells = r->cells + y * r->board_width;
+        int py0 = y * r->size;
+        unsigned int* first = r->pixels + py0 * r->stride;
+
+        expand(cells, whole, r, first);
+        if (edge > 0 && whole < r->board_width) {
+            unsigned int pixel = r->palette[cells[whole] % r->num_colors];
+            for (int j = 0; j < edge; j++) {
+                first[whole * r->size + j] = pixel;
+            }
+        }
+
+        int py1 = py0 + r->size < r->height ? py0 + r->size : r->height;
+        for (int py = py0 + 1; py < py1; py++) {
+            memcpy(r->pixels + py * r->stride, first, r->width * sizeof(unsigned int));
+        }
+    }
+}
+
+static void* worker(void* arg) {
+    /* Waits for jobs and draws band number arg of each one */
+    int band = (int)(long)arg;
+    unsigned long seen = start_id;
+
+    pthread_mutex_lock(&lock);
+    while (1) {
+        while (job_id == seen && !quitting) {
+            pthread_cond_wait(&job_ready, &lock);
+        }
+        if (quitting) {
+            break;
+        }
+        seen = job_id;
+        RasterJob r = job;
+        pthread_mutex_unlock(&lock);
+
+        raster_band(&r, band, num_threads);
+
+        pthread_mutex_lock(&lock);
+        if (--bands_left == 0) {
+            pthread_cond_signal(&job_done);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+void raster_setup(int threads, size_t size) {
+    /* Starts threads - 1 workers, the caller draws the first band itself
+    Falls back to fewer threads if they can't be started. Also picks the
+    row expanders specialized for size, if there are any */
+#ifdef RASTER_X86
+    use_ssse3 = __builtin_cpu_supports("ssse3");
+#endif
+    expand_size = size;
+    expand_row_scalar = expand_scalar_any;
+    expand_row_ssse3 = SSSE3_ENTRY(any);
+    for (size_t i = 0; i < sizeof(expanders) / sizeof(expanders[0]); i++) {
+        if (expanders[i].size == size) {
+            expand_row_scalar = expanders[i].scalar;
+            expand_row_ssse3 = expanders[i].ssse3;
+        }
+    }
+
+    if (threads > RASTER_MAX_THREADS) {
+        threads = RASTER_MAX_THREADS;
+    }
+    quitting = false;
+    start_id = job_id;
+    num_threads = 1;
+    for (int i = 1; i < threads; i++) {
+        if (pthread_create(&workers[i], NULL, worker, (void*)(long)i) != 0) {
+            perror("Failed to start a raster thread");
+            break;
+        }
+        num_threads++;
+    }
+}
+
+void raster_board(const int* cells, int board_width, int board_height,
+                  const unsigned int* palette, int num_colors, size_t size,
+                  unsigned int* pixels, int stride, int width, int height) {
+    /* Draws every cell of the board into the width x height pixels,
+    cell states index into palette. Returns once the whole frame is done */
+    if (num_threads == 0) {
+        num_threads = 1; // never set up, just draw on this thread
+    }
+    RasterJob r = {cells, board_width, board_height, palette, num_colors, size,
+                   pixels, stride, width, height};
+
+    pthread_mutex_lock(&lock);
+    job = r;
+    job_id++;
+    bands_left = num_threads - 1;
+    pthread_cond_broadcast(&job_ready);
+    pthread_mutex_unlock(&lock);
+
+    raster_band(&r, 0, num_threads);
+
+    pthread_mutex_lock(&lock);
+    while (bands_left > 0) {
+        pthread_cond_wait(&job_done, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void raster_cleanup() {
+    /* Stops the workers */
+    pthread_mutex_lock(&lock);
+    quitting = true;
+    pthread_cond_broadcast(&job_ready);
+    pthread_mutex_unlock(&lock);
+    for (int i = 1; i < num_threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    num_threads = 0;
+}
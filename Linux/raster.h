@@ -0,0 +1,15 @@
+#ifndef RASTER_H
+#define RASTER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define RASTER_MAX_THREADS 8
+
+void raster_setup(int num_threads, size_t size);
+void raster_board(const int* cells, int board_width, int board_height,
+                  const unsigned int* palette, int num_colors, size_t size,
+                  unsigned int* pixels, int stride, int width, int height);
+void raster_cleanup();
+
+#endif // RASTER_H
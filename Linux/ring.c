@@ -0,0 +1,56 @@
+/* ring.c
+Single-producer single-consumer ring for handing work between two threads.
+Each side only ever writes its own counter and tells full from empty by
+reading the other's, so pushing and popping never take a lock. Neither
+side sleeps in here; a caller with nothing to do waits on its own wakeup
+*/
+#include "ring.h"
+
+void ring_init(Ring* ring, int size) {
+    /* Sets up an empty ring of size slots */
+    ring->size = size;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+}
+
+static unsigned advance(Ring* ring, unsigned counter) {
+    /* Counters run over twice the size, so full and empty look different
+    and nothing jumps when they wrap */
+    return (counter + 1) % (2 * ring->size);
+}
+
+int ring_begin_push(Ring* ring) {
+    /* Returns the slot to fill next, or -1 if the ring is full. Call
+    ring_end_push once the slot is filled */
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    // pairs with the release in ring_end_pop, so the consumer is done with the slot
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head == (tail + ring->size) % (2 * ring->size)) {
+        return -1;
+    }
+    return head % ring->size;
+}
+
+void ring_end_push(Ring* ring) {
+    /* Hands the filled slot over to the consumer */
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    atomic_store_explicit(&ring->head, advance(ring, head), memory_order_release);
+}
+
+int ring_begin_pop(Ring* ring) {
+    /* Returns the oldest filled slot, or -1 if the ring is empty. The slot
+    stays ours until ring_end_pop */
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    // pairs with the release in ring_end_push, so the slot's contents are visible
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (head == tail) {
+        return -1;
+    }
+    return tail % ring->size;
+}
+
+void ring_end_pop(Ring* ring) {
+    /* Gives the slot back to the producer */
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, advance(ring, tail), memory_order_release);
+}
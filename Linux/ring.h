@@ -0,0 +1,21 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdatomic.h>
+
+// Bounded single-producer single-consumer queue of slot indices. The
+// caller keeps the slot data in its own array of the same size; the ring
+// only hands out which slot to fill or read next
+typedef struct Ring {
+    int size;
+    atomic_uint head; // pushes so far, modulo twice the size, only the producer writes it
+    atomic_uint tail; // pops so far, modulo twice the size, only the consumer writes it
+} Ring;
+
+void ring_init(Ring* ring, int size);
+int ring_begin_push(Ring* ring);
+void ring_end_push(Ring* ring);
+int ring_begin_pop(Ring* ring);
+void ring_end_pop(Ring* ring);
+
+#endif // RING_H
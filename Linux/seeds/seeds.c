@@ -17,6 +17,7 @@ Description: This program reads a Seeds board state and generates some number of
 #include <time.h>
 #include <math.h>
 #include "seeds.h"
+#include "../damage.h"
 
 // Commented out to keep purely library
 // int main(){
@@ -127,6 +128,11 @@ int* seeds_gen_next(int* pattern, int width, int height) {
 
             // Seeds rule: B2/S
             next_pattern[cell_index] = (!pattern[cell_index] && live_neighbors == 2);
+
+            // let the draw loop know what to redraw
+            if (next_pattern[cell_index] != pattern[cell_index]) {
+                damage_mark(cell_index);
+            }
         }
     }
 
@@ -191,6 +197,9 @@ void seeds_add_life(int* pattern, int width, int height, int percent_alive) {
     for (int i = 0; i < width * height; i++) {
         if (pattern[i] == 0) {
             pattern[i] = (rand() % 100) < percent_alive;
+            if (pattern[i]) {
+                damage_mark(i);
+            }
         }
     }
 }
@@ -11,12 +11,29 @@ Heavily abstracted away into not-so-pretty libraries
 #include <unistd.h>
 #include <string.h>
 #include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
 
 #include "x11_lib.h"
+#include "damage.h"
+#include "ring.h"
+#include "governor.h"
+#include "throttle.h"
+#include "loop.h"
 #include "game_of_life/game_of_life.h"
 #include "brians_brain/brians_brain.h"
 #include "seeds/seeds.h"
 #include "langtons_ant/langtons_ant.h"
+#include "langtons_ant/ant_heat.h"
 
 #define DAEMONIZE   1
 #define CIRCLE      (1 << 1)
@@ -26,14 +43,44 @@ Heavily abstracted away into not-so-pretty libraries
 #define NO_RESTOCK  (1 << 5)
 #define SEEDS       (1 << 6)
 #define ANT         (1 << 7)
+#define UNBOUNDED   (1 << 8)
+#define FOLLOW      (1 << 9)
+#define HEAT        (1 << 10)
+#define FRAMEBUFFER (1 << 11)
+#define STATS       (1 << 12)
+#define NO_SHM      (1 << 13)
+#define BATCH       (1 << 14)
+#define MERGE_ROWS  (1 << 15)
+#define XRENDER     (1 << 16)
+#define ROOT        (1 << 17)
+#define VSYNC       (1 << 18)
+#define PIPELINE    (1 << 19)
+#define GOVERN      (1 << 20)
+#define IDLE        (1 << 21)
+#define SUSPEND     (1 << 22)
+
+#define STATS_FRAMES 100 // frames averaged per -stats line
+
+#define HEAT_SHADES 32
+
+#define PIPELINE_FRAMES 3 // boards the simulation can get ahead of the screen
+#define PIPELINE_COMMANDS 256 // edits in flight back to the simulation
+
+#define SUSPEND_POLL_MS 250 // how often to look again while nobody can see us
 
 /* General purpose cmd-line args */
 typedef struct Args {
     ARGB alive_color, dead_color, dying_color;
-    uchar flags;
+    uint flags;
     Ant* ants;
     int num_ants;
+    int ant_steps;
+    int heat_gens;
     float framerate;
+    float display_fps; // 0 to show one frame per generation
+    int max_gens; // most generations per frame the governor may run
+    float frame_budget; // ms of work per frame for the governor, 0 for no limit
+    float cpu_budget; // percent of one core to stay under, 0 for no limit
 } Args;
 
 /* Struct to store board information */
@@ -42,17 +89,98 @@ typedef struct Board {
     int* pattern;
 } Board;
 
+/* One generation handed from the simulation thread to the screen */
+typedef struct Frame {
+    int* pattern;
+    int* cells; // what changed since the frame before
+    int count;
+    bool full; // everything changed, cells is meaningless
+    Ant* ants; // where the ants were, they keep moving
+    int origin_x, origin_y; // ant viewport
+    double gen_ms; // time spent generating this board, for -stats
+    int edits; // commands applied before this board
+} Frame;
+
+/* Edits made on screen, handed back to the simulation thread */
+typedef enum CommandType {
+    ADD_CELL,
+    CLEAR_BOARD
+} CommandType;
+
+typedef struct Command {
+    CommandType type;
+    int cell;
+} Command;
+
 // Globals
 size_t CELL_SIZE = 25;
 bool add_mode = false;
 void (*fill_func)(int, int, size_t); // x, y, size
+void (*rect_func)(int, int, int, int, size_t); // x, y, w, h, size; NULL for circles
 Args* args;
 int cur_color;
 ARGB* color_list;
+uint* pixel_list; // color_list packed into pixels once, for color_pixel
+
+// Changes from the previous frame, redrawn again when two framebuffers take turns
+int* prev_damage = NULL;
+int prev_damage_count = 0;
+bool prev_damage_full = true;
 
 // Langton's Ant specific globals
 size_t num_colors;
-char ruleset[128]; // null-terminated string of rules, max 127 chars + null
+char* ruleset = NULL; // null-terminated string of rules
+AntRule* turmite_rules = NULL; // (state, color) transition table for turmites
+int num_states = 0; // number of turmite states, 0 for plain ants
+uint heat_pixels[HEAT_SHADES]; // hottest to fully faded
+int heat_origin_x = 0, heat_origin_y = 0; // viewport the heatmap was built for
+
+// Simulation functions, picked in main
+int* (*gen_next)(int*, int, int);
+int* (*gen_random)(int, int, int);
+void (*add_random)(int*, int, int, int);
+float restock_thresh;
+int iter_count = 0;
+
+// -pipeline: the simulation runs on its own thread, a few boards ahead
+bool pipelined = false;
+Ring frame_ring, command_ring;
+Frame frames[PIPELINE_FRAMES];
+Command commands[PIPELINE_COMMANDS];
+sem_t sim_wake; // a frame was shown or a command came in
+pthread_t sim_thread;
+atomic_bool sim_stopping = false; // set by stop_simulation, checked between generations
+int frame_ready = -1; // eventfd the simulation thread bumps for every frame it pushes
+bool waiting_for_frame = false; // a frame was due but the ring was empty
+int edits_sent = 0; // screen side, frames from before the last of these are stale
+int edits_applied = 0; // simulation side
+bool frame_dropped = false; // the next frame shown has to cover the dropped one's damage
+// edits waiting for room in the command ring, so the screen never blocks on it
+Command* unsent = NULL;
+int unsent_start = 0, unsent_end = 0;
+bool* cell_unsent = NULL; // cells with an ADD_CELL in unsent, so a drag adds each once
+
+// Main loop state, everything frames need between one timer tick and the next
+Board cur_board;
+int fade_steps = 1; // frames shown per generation, the ones in between crossfade the changes
+int fade_step = 1; // crossfade step shown next, fade_steps means the generation itself
+int* prev_pattern = NULL; // last generation, for crossfading with -dfps
+bool full_redraw = true; // the heatmap only redraws everything on the first frame or when the view moves
+bool paused = false;
+bool suspended = false; // nobody can see the window
+bool vblank_pending = false; // with -vsync, the next frame waits for this one to be shown
+double stat_draw_ms = 0, stat_gen_ms = 0; // running totals for -stats
+int stat_frames = 0;
+
+// Event loop file descriptors
+int frame_timer = -1; // goes off when the next frame is due
+int check_timer = -1; // looks at the visibility again while suspended
+int signal_fd = -1; // SIGINT and SIGTERM
+
+// Frame pacing, on absolute deadlines of the monotonic clock
+struct timespec frame_deadline;
+long frame_period_ns;
+int missed_deadlines = 0; // frames that were already late, for -stats
 
 void usage() {
     fprintf(stderr, "Usage: simwall [options]\n");
@@ -63,6 +191,11 @@ void usage() {
     fprintf(stderr, "  -alive FFFFFFFF: Set the alive cell color (RGBA)\n");
     fprintf(stderr, "  -dying 808080FF: Set the dying cell color (RGBA)\n");
     fprintf(stderr, "  -fps 10.0: Set the framerate\n");
+    fprintf(stderr, "  -dfps 60: Show frames this often, crossfading changed cells between generations\n");
+    fprintf(stderr, "  -budget 50: Run as many generations per frame as it takes to keep up with -fps, within this many ms of work\n");
+    fprintf(stderr, "  -gpf 8: Most generations per frame for the governor, turns it on without a budget\n");
+    fprintf(stderr, "  -cpu-budget 5%%: Slow down generations and frames to stay under this much of one core\n");
+    fprintf(stderr, "  -idle: Run at idle priority so anything else gets the CPU first\n");
     fprintf(stderr, "  -bb: Run Brian's Brain (BB) instead of Game of Life\n");
     fprintf(stderr, "  -seeds: Run Seeds instead of Game of Life\n");
     fprintf(stderr, "  -ant <ant_params.txt>: Run Langton's Ant instead of Game of Life.\n");
@@ -79,81 +212,253 @@ void usage() {
     fprintf(stderr, "       Cell color list length must be >= to ruleset length and\n");
     fprintf(stderr, "         can be set to default values by providing the keyword \"default\"\n");
     fprintf(stderr, "         or \"default_alpha\" for a transparent background\n");
+    fprintf(stderr, "       Turmites (ants with states) replace the ruleset line:\n");
+    fprintf(stderr, "         turmite NUM_STATES NUM_COLORS\n");
+    fprintf(stderr, "         CELL COLOR LIST\n");
+    fprintf(stderr, "         STATE 0 TABLE ROW\n");
+    fprintf(stderr, "         STATE 1 TABLE ROW\n");
+    fprintf(stderr, "         etc...\n");
+    fprintf(stderr, "         X0 Y0 START_DIRECTION ANT0_COLOR [START_STATE]\n");
+    fprintf(stderr, "         etc...\n");
+    fprintf(stderr, "       Each table row has one WRITE_COLOR TURN NEXT_STATE entry per cell\n");
+    fprintf(stderr, "         color, written without spaces (ex. 1R0 0L1)\n");
+    fprintf(stderr, "  -steps 1: Steps each ant takes per frame\n");
+    fprintf(stderr, "  -unbounded: Let ants walk off the screen instead of wrapping around\n");
+    fprintf(stderr, "  -follow: Keep the ants on screen by following them. Includes -unbounded\n");
+    fprintf(stderr, "  -heat 200: Shade ant trails by how recently they were visited,\n");
+    fprintf(stderr, "             fading out over the given number of frames\n");
     fprintf(stderr, "  -c: Draw circles instead of a squares\n");
     fprintf(stderr, "  -s 25: Set the cell size in pixels\n");
+    fprintf(stderr, "  -fb: Draw into a client-side framebuffer, sent with one request per frame\n");
+    fprintf(stderr, "  -batch: Send cells with one X request per color per frame\n");
+    fprintf(stderr, "  -pipeline: Generate the next boards on a second thread while drawing\n");
+    fprintf(stderr, "  -vsync: Show frames on vblank with the Present extension, at whole multiples of the refresh interval\n");
+    fprintf(stderr, "  -root: Draw as the root window's background instead of in a desktop window (no transparency)\n");
+    fprintf(stderr, "  -xrender: Draw one pixel per cell and let the X server scale it up (squares only)\n");
+    fprintf(stderr, "  -mergerows: Also merge identical adjacent rows into taller rectangles\n");
+    fprintf(stderr, "  -noshm: Don't use MIT-SHM shared memory for -fb\n");
+    fprintf(stderr, "  -stats: Print average draw and generation times and missed frame deadlines every %d frames\n", STATS_FRAMES);
     fprintf(stderr, "  -nk: Disable keybinds\n");
+    fprintf(stderr, "  -nv: Keep running while the window is covered or the screen is off\n");
     fprintf(stderr, "  -nr: No restocking if board is too empty\n");
     fprintf(stderr, "  -clear: Start with a clear board. Includes -nr\n");
     fprintf(stderr, "Example: simwall -dead FF00FFFF -alive FFFF00FF -fps 7.5\n");
     exit(1);
 }
 
+void stop_simulation();
+
 void cleanup() {
     /* Cleans up the program */
+    // the simulation thread uses most of what gets freed here, so it goes first
+    if (pipelined) {
+        stop_simulation();
+    }
     free(color_list);
+    free(pixel_list);
+    free(prev_damage);
+    damage_cleanup();
+    if (args->flags & ANT) {
+        ant_cleanup();
+    }
+    if (args->flags & HEAT) {
+        heat_cleanup();
+    }
     free(args->ants);
+    free(turmite_rules);
+    free(ruleset);
     free(args);
+    raster_cleanup();
     x11_cleanup();
     exit(0);
 }
 
-int count_lines(const char* filename) {
-    FILE *file = fopen(filename, "r");
-    if (file == NULL) {
-        perror("Failed to open file");
-        return -1; // Indicate error
+/* Helpers for parse_ants_file, which reads a memory-mapped ants file in a
+single pass. The mapping isn't null-terminated, so everything is bounded by
+an end pointer instead of using the str* functions */
+typedef struct TextSpan {
+    const char* pos;
+    const char* end;
+    int line_num;
+} TextSpan;
+
+static bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static bool next_line(TextSpan* file, TextSpan* line) {
+    /* Splits the next non-empty line off of file, returns false at EOF */
+    while (file->pos < file->end) {
+        const char* start = file->pos;
+        const char* stop = memchr(start, '\n', file->end - start);
+        if (stop == NULL) {
+            stop = file->end; // last line without a trailing newline
+        }
+        file->pos = stop < file->end ? stop + 1 : stop;
+        file->line_num++;
+
+        // trim whitespace (and windows line endings) off both ends
+        while (start < stop && is_blank(*start)) {
+            start++;
+        }
+        while (stop > start && is_blank(stop[-1])) {
+            stop--;
+        }
+        if (start < stop) {
+            line->pos = start;
+            line->end = stop;
+            line->line_num = file->line_num;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool next_token(TextSpan* line, TextSpan* token) {
+    /* Splits the next space delimited token off of line */
+    while (line->pos < line->end && is_blank(*line->pos)) {
+        line->pos++;
     }
+    if (line->pos >= line->end) {
+        return false;
+    }
+    token->pos = line->pos;
+    while (line->pos < line->end && !is_blank(*line->pos)) {
+        line->pos++;
+    }
+    token->end = line->pos;
+    token->line_num = line->line_num;
+    return true;
+}
 
-    int line_count = 0;
-    char ch;
+static bool token_is(TextSpan* token, const char* word) {
+    /* Checks if the token is exactly word */
+    size_t len = strlen(word);
+    return (size_t)(token->end - token->pos) == len && memcmp(token->pos, word, len) == 0;
+}
 
-    // Read file character by character
-    while ((ch = fgetc(file)) != EOF) {
-        if (ch == '\n') {
-            line_count++;
+static bool read_int(TextSpan* cur, int* out) {
+    /* Reads a (possibly negative) decimal int from the front of cur */
+    bool negative = cur->pos < cur->end && *cur->pos == '-';
+    const char* p = cur->pos + negative;
+    long value = 0;
+    const char* digits = p;
+    while (p < cur->end && *p >= '0' && *p <= '9') {
+        value = value * 10 + (*p - '0');
+        if (value > 2147483647L) {
+            return false;
         }
+        p++;
+    }
+    if (p == digits) {
+        return false;
     }
+    *out = negative ? -value : value;
+    cur->pos = p;
+    return true;
+}
 
-    fclose(file);
-    return line_count;
+static bool read_whole_int(TextSpan* token, int* out) {
+    /* Reads an int that has to be the entire token, so 12abc isn't 12 */
+    return read_int(token, out) && token->pos == token->end;
 }
 
-void parse_ants_file(FILE* ants_file, const char* filename) {
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static bool read_color(TextSpan* token, ARGB* out) {
+    /* Reads an 8 digit RRGGBBAA hex token into out */
+    if (token->end - token->pos != 8) {
+        return false;
+    }
+    unsigned short channels[4];
+    for (int i = 0; i < 4; i++) {
+        int hi = hex_digit(token->pos[2*i]);
+        int lo = hex_digit(token->pos[2*i + 1]);
+        if (hi < 0 || lo < 0) {
+            return false;
+        }
+        channels[i] = hi << 4 | lo;
+    }
+    *out = (ARGB){channels[3], channels[0], channels[1], channels[2]};
+    return true;
+}
+
+static void ants_file_error(const char* what, TextSpan* line) {
+    /* Reports a bad line of the ants file and bails out */
+    fprintf(stderr, "%s on line %d: %.*s\n", what, line->line_num,
+            (int)(line->end - line->pos), line->pos);
+    usage();
+}
+
+void parse_ants_file(const char* filename) {
+    /* Reads the ruleset (or turmite table), colors and ants from filename.
+    The file is memory-mapped and read once from front to back, growing the
+    ant array as it goes, so huge ant populations load quickly */
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Could not open file: %s\n", filename);
+        usage();
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        fprintf(stderr, "Invalid ant file: %s\n", filename);
+        usage();
+    }
+    char* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("Failed to map ants file");
+        usage();
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    TextSpan file = {data, data + st.st_size, 0};
+    TextSpan line, token;
+
     // read the ruleset
-    if (fgets(ruleset, 128, ants_file) == NULL) {
+    if (!next_line(&file, &line)) {
         fprintf(stderr, "Failed to read from file or EOF reached.\n");
         usage();
     }
-    ruleset[strlen(ruleset) - 1] = '\0'; // Ensure null-terminated, also remove newline
+    TextSpan header = line;
+    next_token(&header, &token);
+    if (token_is(&token, "turmite")) {
+        // turmites give their state and color counts instead of a ruleset
+        int inp_num_colors;
+        if (!next_token(&header, &token) || !read_whole_int(&token, &num_states) ||
+            !next_token(&header, &token) || !read_whole_int(&token, &inp_num_colors) ||
+            num_states < 1 || num_states > 256 || inp_num_colors < 2 || inp_num_colors > 256) {
+            ants_file_error("Turmites need 1-256 states and 2-256 colors", &line);
+        }
+        num_colors = inp_num_colors;
+    } else {
+        // cells are stored as bytes, so there can be at most 256 rules
+        // and like turmites, at least 2 colors to go between
+        num_colors = line.end - line.pos;
+        if (num_colors < 2 || num_colors > 256) {
+            ants_file_error("Rulesets need 2-256 rules", &line);
+        }
+        ruleset = strndup(line.pos, num_colors);
+    }
 
     // read the color list line
-    char color_list_str[2048]; // 2048 is big enough for 128 * 9 (8 hex + 1 space)
-    if (fgets(color_list_str, 2048, ants_file) == NULL) {
+    if (!next_line(&file, &line)) {
         fprintf(stderr, "Failed to read from file or EOF reached.\n");
         usage();
-    } 
-    color_list_str[strlen(color_list_str)-1] = '\0'; // remove the newline
-    
-    // parse the color list
-    char* color_str = strtok(color_list_str, " ");
-
-    // how many colors there SHOULD be
-    num_colors = strlen(ruleset);
+    }
     // allocate space for the color list
     color_list = (ARGB*)malloc(num_colors * sizeof(ARGB));
 
     // check if it should be default colors
-    bool use_defaults = false;
-    bool use_alpha = false;
-    // check if they wanted alpha background
-    if (strcmp(color_str, "default_alpha") == 0) {
-        use_alpha = true;
-    }
-
-    // then, if they wanted default colors at all
-    if (strcmp(color_str, "default") == 0 || use_alpha) {
-        // default colors
-        use_defaults = true;
+    TextSpan colors = line;
+    next_token(&colors, &token);
+    bool use_alpha = token_is(&token, "default_alpha");
+    if (token_is(&token, "default") || use_alpha) {
         // define step size to be equal steps between 0 and 255
             // num_colors-1 ensure background is black and fully on is white
         int step_size = 255 / (num_colors-1);
@@ -163,68 +468,101 @@ void parse_ants_file(FILE* ants_file, const char* filename) {
         }
         if (use_alpha) {
             // set the background color to be transparent instead of black
-            color_list[0] = (ARGB){0, 0, 0, 0};   
+            color_list[0] = (ARGB){0, 0, 0, 0};
         }
-    }
-
-
-    // if we're not using the default colors, i.e. they gave us some
-    if (!use_defaults) {
+    } else {
         // if there are too many colors, skip em!
         for (int j = 0; j < num_colors; j++) {
-            // check for errors
-            if (color_str == NULL) { // not enough colors
-                fprintf(stderr, "Color list too short\n");
-                usage();
+            if (j > 0 && !next_token(&colors, &token)) { // not enough colors
+                ants_file_error("Color list too short", &line);
             }
-            if (strlen(color_str) != 8) { // not a valid color
-                fprintf(stderr, "Invalid color: %s\n", color_str);
-                usage();
+            if (!read_color(&token, &color_list[j])) { // not a valid color
+                ants_file_error("Invalid color", &line);
             }
-
-            // convert the hex to ARGB
-            sscanf(color_str, "%2hx%2hx%2hx%2hx", &color_list[j].r, &color_list[j].g, &color_list[j].b, &color_list[j].a);
-            // get the next color
-            // not 100% on why the NULL is needed here instead of color_list_str, but it is
-            color_str = strtok(NULL, " ");
         }
     }
 
     // set dead color because it's used as window background
     args->dead_color = color_list[0];
 
-    // read the number of ants
-    args->num_ants = count_lines(filename)-2;
-    if (args->num_ants <= 0) {
-        fprintf(stderr, "Invalid ant file: %s\n", filename);
-        usage();
+    // read the turmite transition table, one row per state
+    if (num_states > 0) {
+        turmite_rules = (AntRule*)malloc(num_states * num_colors * sizeof(AntRule));
+        for (int s = 0; s < num_states; s++) {
+            if (!next_line(&file, &line)) {
+                fprintf(stderr, "Turmite table too short, expected %d rows\n", num_states);
+                usage();
+            }
+
+            TextSpan row = line;
+            for (int c = 0; c < num_colors; c++) {
+                // each entry looks like 1R0: write color, turn, next state
+                if (!next_token(&row, &token)) {
+                    ants_file_error("Invalid turmite table row", &line);
+                }
+                // split it around the turn letter, so each number is read whole
+                const char* letter = token.pos;
+                while (letter < token.end && (*letter == '-' || (*letter >= '0' && *letter <= '9'))) {
+                    letter++;
+                }
+                TextSpan write_part = {token.pos, letter, token.line_num};
+                TextSpan next_part = {letter + 1, token.end, token.line_num};
+                int write, next, turn = letter < token.end ? ant_turn_from_rule(*letter) : -1;
+                if (turn < 0 || !read_whole_int(&write_part, &write) || !read_whole_int(&next_part, &next) ||
+                    write < 0 || write >= num_colors || next < 0 || next >= num_states) {
+                    ants_file_error("Invalid turmite table entry", &line);
+                }
+                turmite_rules[s * num_colors + c] = (AntRule){write, turn, next};
+            }
+            if (next_token(&row, &token)) {
+                ants_file_error("Turmite table row too long", &line);
+            }
+        }
     }
 
-    // allocate space for the ants
-    args->ants = (Ant*)malloc(args->num_ants * sizeof(Ant));
-    // read the ants
-    for (int j = 0; j < args->num_ants; j++) {
+    // read the ants, growing the array as we go
+    int capacity = 64;
+    args->num_ants = 0;
+    args->ants = (Ant*)malloc(capacity * sizeof(Ant));
+    while (next_line(&file, &line)) {
         Ant ant;
-        char line[256];
-        // read in a line
-        if (fgets(line, 256, ants_file) == NULL) {
-            fprintf(stderr, "Failed to read from file or EOF reached.\n");
-            usage();
+        int direction;
+        TextSpan fields = line;
+        // parse the line, turmites may also give a start state
+        if (!next_token(&fields, &token) || !read_whole_int(&token, &ant.x) ||
+            !next_token(&fields, &token) || !read_whole_int(&token, &ant.y) ||
+            !next_token(&fields, &token) || !read_whole_int(&token, &direction) ||
+            !next_token(&fields, &token) || !read_color(&token, &ant.color) ||
+            direction < 0 || direction >= NUM_DIRS) {
+            ants_file_error("Invalid ant line", &line);
         }
-        // parse the line
-        int num = sscanf(line, "%d %d %d %2hx%2hx%2hx%2hx\n",
-                    &ant.x, &ant.y, (int*)&ant.direction,
-                    &ant.color.r, &ant.color.g, &ant.color.b, &ant.color.a);
-        // check for errors (lightly, not a full check)
-        if (num != 7) {
-            fprintf(stderr, "Invalid ant line: %s\n", line);
-            usage();
+        ant.direction = direction;
+        ant.state = 0;
+        if (next_token(&fields, &token)) {
+            if (num_states == 0 || !read_whole_int(&token, &ant.state) ||
+                ant.state < 0 || ant.state >= num_states) {
+                ants_file_error("Invalid ant state", &line);
+            }
         }
+
         // add the ant to the list
-        args->ants[j] = ant;
+        if (args->num_ants == capacity) {
+            capacity *= 2;
+            args->ants = (Ant*)realloc(args->ants, capacity * sizeof(Ant));
+            if (args->ants == NULL) {
+                perror("Failed to allocate memory for ants");
+                exit(EXIT_FAILURE);
+            }
+        }
+        args->ants[args->num_ants++] = ant;
     }
 
+    if (args->num_ants <= 0) {
+        fprintf(stderr, "Invalid ant file: %s\n", filename);
+        usage();
+    }
 
+    munmap(data, st.st_size);
 }
 
 void parse_args(int argc, char **argv) {
@@ -237,10 +575,14 @@ void parse_args(int argc, char **argv) {
 
     // define all the simulation flags, used for mutual exclusion later
     int all_sims = BB | SEEDS | ANT;
+    // and the drawing modes
+    int all_renderers = FRAMEBUFFER | BATCH | XRENDER;
 
     // set defaults
     args->flags |= KEYBINDS; // set keybinds to default to on
+    args->flags |= SUSPEND; // and stopping while nobody can see the window
     args->framerate = 10.0;
+    args->max_gens = 8;
     
     args->alive_color.a = 255;
     args->alive_color.r = 255;
@@ -331,6 +673,47 @@ void parse_args(int argc, char **argv) {
             args->framerate = atof(argv[i+1]);
             i += 1; 
         }
+        // display rate, separate from the generation rate
+        else if (strcmp(argv[i], "-dfps") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Not enough arguments for -dfps\n");
+                usage();
+            }
+            args->display_fps = atof(argv[i+1]);
+            i += 1;
+        }
+        // generations per frame governor
+        else if (strcmp(argv[i], "-gpf") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Not enough arguments for -gpf\n");
+                usage();
+            }
+            args->max_gens = atoi(argv[i+1]);
+            args->flags |= GOVERN;
+            i += 1;
+        }
+        else if (strcmp(argv[i], "-budget") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Not enough arguments for -budget\n");
+                usage();
+            }
+            args->frame_budget = atof(argv[i+1]);
+            args->flags |= GOVERN;
+            i += 1;
+        }
+        // CPU use cap, as a percent of one core
+        else if (strcmp(argv[i], "-cpu-budget") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Not enough arguments for -cpu-budget\n");
+                usage();
+            }
+            args->cpu_budget = atof(argv[i+1]); // stops at the %
+            i += 1;
+        }
+        // background priority
+        else if (strcmp(argv[i], "-idle") == 0) {
+            args->flags |= IDLE;
+        }
         // cell size
         else if (strcmp(argv[i], "-s") == 0) {
             if (i + 1 >= argc) {
@@ -340,10 +723,50 @@ void parse_args(int argc, char **argv) {
             CELL_SIZE = atoi(argv[i+1]);
             i += 1;
         }
+        // client-side framebuffer
+        else if (strcmp(argv[i], "-fb") == 0) {
+            args->flags = (args->flags & ~all_renderers) | FRAMEBUFFER;
+        }
+        // batched X requests
+        else if (strcmp(argv[i], "-batch") == 0) {
+            args->flags = (args->flags & ~all_renderers) | BATCH;
+        }
+        // merge identical rows when drawing the whole board
+        else if (strcmp(argv[i], "-mergerows") == 0) {
+            args->flags |= MERGE_ROWS;
+        }
+        // simulation on its own thread
+        else if (strcmp(argv[i], "-pipeline") == 0) {
+            args->flags |= PIPELINE;
+        }
+        // vsync through the Present extension
+        else if (strcmp(argv[i], "-vsync") == 0) {
+            args->flags |= VSYNC;
+        }
+        // draw on the root window's background
+        else if (strcmp(argv[i], "-root") == 0) {
+            args->flags |= ROOT;
+        }
+        // server-side scaling through XRender
+        else if (strcmp(argv[i], "-xrender") == 0) {
+            args->flags = (args->flags & ~all_renderers) | XRENDER;
+        }
+        // no shared memory for the framebuffer
+        else if (strcmp(argv[i], "-noshm") == 0) {
+            args->flags |= NO_SHM;
+        }
+        // frame timing
+        else if (strcmp(argv[i], "-stats") == 0) {
+            args->flags |= STATS;
+        }
         // disable keybinds
         else if (strcmp(argv[i], "-nk") == 0) {
             args->flags &= ~KEYBINDS;
         }
+        // keep running while nobody can see the window
+        else if (strcmp(argv[i], "-nv") == 0) {
+            args->flags &= ~SUSPEND;
+        }
         // brians brain
         else if (strcmp(argv[i], "-bb") == 0) {
             args->flags = (args->flags & ~all_sims) | BB;
@@ -364,18 +787,34 @@ void parse_args(int argc, char **argv) {
             }
 
             // otherwise, we have an ant file to parse
-            // open the file
-            FILE* ants_file = fopen(argv[i+1], "r");
-            if (!ants_file) {
-                fprintf(stderr, "Could not open file: %s\n", argv[i+1]);
+            parse_ants_file(argv[i+1]);
+            i += 1;
+        }
+        // unbounded plane for ants
+        else if (strcmp(argv[i], "-unbounded") == 0) {
+            args->flags |= UNBOUNDED;
+        }
+        // unbounded plane with the view following the ants
+        else if (strcmp(argv[i], "-follow") == 0) {
+            args->flags |= UNBOUNDED | FOLLOW;
+        }
+        // ant steps per frame
+        else if (strcmp(argv[i], "-steps") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Not enough arguments for -steps\n");
                 usage();
             }
-            
-            // parse the file
-            parse_ants_file(ants_file, argv[i+1]);
-
-            // remember to close the file
-            fclose(ants_file);
+            args->ant_steps = atoi(argv[i+1]);
+            i += 1;
+        }
+        // trail-age heatmap for ants
+        else if (strcmp(argv[i], "-heat") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Not enough arguments for -heat\n");
+                usage();
+            }
+            args->flags |= HEAT;
+            args->heat_gens = atoi(argv[i+1]);
             i += 1;
         }
         // clear start
@@ -392,80 +831,843 @@ void parse_args(int argc, char **argv) {
             usage();
         }
     }
+
+    // the heatmap shades ant trails, other simulations have nothing to shade
+    if (args->flags & HEAT && !(args->flags & ANT)) {
+        fprintf(stderr, "-heat only works with -ant\n");
+        usage();
+    }
 }
 
-void handle_keybinds(Board* cur_board) {
-    /* Handles the keybinds for the program
-    Meant to be run in the main loop
-    Takes the filling function being used */
+void timer_at(int timer, struct timespec when) {
+    /* Sets timer to go off once at when on the monotonic clock, a time
+    that's already past goes off right away */
+    struct itimerspec spec = {{0, 0}, when};
+    timerfd_settime(timer, TFD_TIMER_ABSTIME, &spec, NULL);
+}
 
-    // Quit if Ctrl-Alt-Q is pressed
-    if (check_for_keybind("Q")) {
+void timer_stop(int timer) {
+    struct itimerspec spec = {{0, 0}, {0, 0}};
+    timerfd_settime(timer, 0, &spec, NULL);
+}
+
+void pacer_reset() {
+    /* Starts the deadlines over from now, e.g. after a pause */
+    clock_gettime(CLOCK_MONOTONIC, &frame_deadline);
+}
+
+void pacer_start() {
+    /* Starts the deadlines over and has the next frame go out right away */
+    pacer_reset();
+    timer_at(frame_timer, frame_deadline);
+}
+
+void pacer_next(int frames) {
+    /* Sets the frame timer for frames display periods after the last
+    deadline. Time spent drawing and generating comes out of the wait, and
+    a frame that's already late counts as missed and starts the deadlines over */
+    throttle_sample();
+    long long ns = frame_deadline.tv_nsec + (long long)(frames * frame_period_ns * throttle_scale());
+    frame_deadline.tv_sec += ns / 1000000000;
+    frame_deadline.tv_nsec = ns % 1000000000;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec > frame_deadline.tv_sec
+        || (now.tv_sec == frame_deadline.tv_sec && now.tv_nsec >= frame_deadline.tv_nsec)) {
+        missed_deadlines++;
+        frame_deadline = now;
+    }
+    timer_at(frame_timer, frame_deadline);
+}
+
+void vsync_next() {
+    /* The frame we sent was shown, so the next one is due now, or however
+    much later the CPU budget wants frames to last */
+    throttle_sample();
+    long long ns = (long long)((throttle_scale() - 1) * frame_period_ns);
+    struct timespec when;
+    clock_gettime(CLOCK_MONOTONIC, &when);
+    ns += when.tv_nsec;
+    when.tv_sec += ns / 1000000000;
+    when.tv_nsec = ns % 1000000000;
+    timer_at(frame_timer, when);
+}
+
+void next_frame(int frames) {
+    /* Schedules the frame after this one. With vsync that's once the
+    X server says this one was shown, otherwise frames display periods on */
+    if (args->flags & VSYNC) {
+        vblank_pending = true;
+    } else {
+        pacer_next(frames);
+    }
+}
+
+void resume_frames() {
+    /* Gets frames going again if nothing is holding them up. The time
+    spent stopped doesn't count as missed frames */
+    if (!paused && !add_mode && !suspended) {
+        pacer_start();
+    }
+}
+
+void suspend() {
+    /* Stops frames while nobody can see the window, with the board left as
+    it was. The check timer looks again every so often for what doesn't
+    send events, like the screensaver and DPMS */
+    suspended = true;
+    struct itimerspec spec = {{0, SUSPEND_POLL_MS * 1000000L}, {0, SUSPEND_POLL_MS * 1000000L}};
+    timerfd_settime(check_timer, 0, &spec, NULL);
+}
+
+void unsuspend() {
+    suspended = false;
+    timer_stop(check_timer);
+    resume_frames();
+}
+
+void flush_commands() {
+    /* Moves as many unsent edits into the command ring as fit, and wakes
+    the simulation thread for them. The rest wait for the next try */
+    bool pushed = false;
+    int slot;
+    while (unsent_start < unsent_end && (slot = ring_begin_push(&command_ring)) >= 0) {
+        Command command = unsent[unsent_start++];
+        if (command.type == ADD_CELL) {
+            cell_unsent[command.cell] = false;
+        }
+        commands[slot] = command;
+        ring_end_push(&command_ring);
+        edits_sent++;
+        pushed = true;
+    }
+    if (unsent_start == unsent_end) {
+        unsent_start = unsent_end = 0;
+    }
+    if (pushed) {
+        sem_post(&sim_wake);
+    }
+}
+
+void send_command(CommandType type, int cell) {
+    /* Queues an edit for the simulation thread without waiting on it.
+    A cell that's still unsent isn't queued twice, and a clear drops
+    everything unsent since it would wipe it anyway, so unsent never
+    holds more than a clear and one edit per cell */
+    if (type == ADD_CELL) {
+        if (cell_unsent[cell]) {
+            return;
+        }
+        cell_unsent[cell] = true;
+    } else {
+        memset(cell_unsent, 0, cur_board.width * cur_board.height * sizeof(bool));
+        unsent_start = unsent_end = 0;
+    }
+    unsent[unsent_end++] = (Command){type, cell};
+    flush_commands();
+}
+
+void clear_board(Board* board) {
+    /* Sets the board to deads */
+    memset(board->pattern, DEAD, board->width * board->height * sizeof(int));
+    if (args->flags & ANT) {
+        // the ants keep their own plane, so clear that too
+        ant_clear();
+    }
+    if (args->flags & HEAT) {
+        heat_reset();
+    }
+    damage_all();
+}
+
+void on_key(char* key) {
+    /* Handles the keybinds for the program, called by x11_dispatch
+    With -pipeline the simulation thread owns the board, so edits are sent
+    to it as commands and only drawn here */
+
+    // Quit on Ctrl-Alt-Q
+    if (strcmp(key, "Q") == 0) {
         // cleanup
         cleanup();
         exit(0);
     }
 
-    // Pause if Ctrl-Alt-P is pressed
-    if (check_for_keybind("P")) {
-        wait_for_keybind("P");
+    // Pause or unpause on Ctrl-Alt-P, paused frames stop until then
+    if (strcmp(key, "P") == 0) {
+        paused = !paused;
+        if (paused) {
+            timer_stop(frame_timer);
+        } else {
+            resume_frames();
+        }
     }
 
-    // Enter add mode if Ctrl-Alt-A is pressed, not in add mode, and not doing ant things
-    if (check_for_keybind("A") && !add_mode && !(args->flags & ANT)) {
-        // set add_mode to true to prevent extra recursion into here
-        add_mode = true;
+    // Enter or leave add mode on Ctrl-Alt-A, not doing ant things
+    // frames stop meanwhile so placed cells don't instantly die
+    if (strcmp(key, "A") == 0 && !(args->flags & ANT)) {
+        add_mode = !add_mode;
+        // presses anywhere on screen come in through on_press while the pointer is ours
+        grab_pointer(add_mode);
+        if (add_mode) {
+            timer_stop(frame_timer);
+        } else {
+            resume_frames();
+        }
+    }
 
-        // set the color to the cell color
-        color(args->alive_color);
-        cur_color = ALIVE;
+    // Clear the board on Ctrl-Alt-D
+    if (strcmp(key, "D") == 0) {
+        if (pipelined) {
+            send_command(CLEAR_BOARD, 0);
+        } else {
+            clear_board(&cur_board);
+        }
 
-        // loop until we're out of add mode (effectively pause)
-            // this is to prevent placed cells from instantly dying
-        while (!check_for_keybind("A")) {
-            // if the left mouse button is being pressed
-            if (is_lmb_pressed()) {
-                // get the mouse position
-                POS mouse_pos = get_mouse_pos();
-                int x = mouse_pos.x / CELL_SIZE;
-                int y = mouse_pos.y / CELL_SIZE;
+        // Set the color
+        color(args->dead_color);
+        cur_color = DEAD;
 
-                // fill the cell
-                cur_board->pattern[y * cur_board->width + x] = ALIVE;
-                fill_func(x, y, CELL_SIZE);
+        // Fill the board right here and now for instant updates!
+        // one rectangle over all of it, cell by cell only for circles
+        if (rect_func) {
+            rect_func(0, 0, cur_board.width, cur_board.height, CELL_SIZE);
+        } else {
+            for (int i = 0; i < cur_board.width * cur_board.height; i++) {
+                (*fill_func)(i % cur_board.width, i / cur_board.width, CELL_SIZE);
             }
+        }
+        present();
+    }
+}
 
-            // also have keybind handling here
-            handle_keybinds(cur_board);
-            // sleep a while
-            usleep(10000);
+void on_press(POS pos) {
+    /* Fills the cell under a left button press or drag in add mode */
+    int x = pos.x / CELL_SIZE;
+    int y = pos.y / CELL_SIZE;
+    if (!add_mode || x < 0 || x >= cur_board.width || y < 0 || y >= cur_board.height) {
+        return;
+    }
+
+    if (pipelined) {
+        send_command(ADD_CELL, y * cur_board.width + x);
+    } else {
+        cur_board.pattern[y * cur_board.width + x] = ALIVE;
+        damage_mark(y * cur_board.width + x);
+    }
+    color(args->alive_color);
+    cur_color = ALIVE;
+    fill_func(x, y, CELL_SIZE);
+    present();
+}
+
+bool all_opaque() {
+    /* Checks that no color we could draw with has any transparency,
+    so the window doesn't need an alpha channel */
+    if (args->alive_color.a < 255 || args->dead_color.a < 255 || args->dying_color.a < 255) {
+        return false;
+    }
+    // the ants file brings its own palette (default_alpha makes the background clear)
+    if (color_list) {
+        for (int j = 0; j < num_colors; j++) {
+            if (color_list[j].a < 255) {
+                return false;
+            }
         }
+    }
+    for (int j = 0; j < args->num_ants; j++) {
+        if (args->ants[j].color.a < 255) {
+            return false;
+        }
+    }
+    return true;
+}
+
+double now_ms() {
+    /* Returns monotonic time in milliseconds, for timing frames */
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
 
-        // set it to false now that we're out
-        add_mode = false;
+void draw_run(Board* board, int i, int w, int h) {
+    /* Draws the w x h block of cells starting at cell i, which all share
+    cell i's state. Rectangles go out as one fill, circles one per cell */
+    // if the color has changed
+    if (board->pattern[i] != cur_color) {
+        // update color accordingly
+            // % num_colors to allow for ANT's variable number of states
+        cur_color = board->pattern[i] % num_colors; 
+        color_pixel(pixel_list[cur_color]);
     }
 
-    // Clear the board if Ctrl-Alt-D is pressed
-    if (check_for_keybind("D")) {
-        // Set the board to deads
-        memset(cur_board->pattern, DEAD, cur_board->width * cur_board->height * sizeof(int));
+    int x = i % board->width, y = i / board->width;
+    if (rect_func) {
+        rect_func(x, y, w, h, CELL_SIZE);
+        return;
+    }
+    for (int dy = 0; dy < h; dy++) {
+        for (int dx = 0; dx < w; dx++) {
+            fill_func(x + dx, y + dy, CELL_SIZE);
+        }
+    }
+}
 
-        // Set the color
-        color(args->dead_color);
+void draw_cells(Board* board, int* cells, int count) {
+    /* Draws a list of changed cells, merging neighbours in the list that
+    sit next to each other in a row and share a state */
+    int i = 0;
+    while (i < count) {
+        int run = 1;
+        while (i + run < count && cells[i + run] == cells[i] + run
+               && cells[i + run] % board->width != 0
+               && board->pattern[cells[i + run]] == board->pattern[cells[i]]) {
+            run++;
+        }
+        draw_run(board, cells[i], run, 1);
+        i += run;
+    }
+}
+
+void fill_margin(int width, int height) {
+    /* Fills one more row and col past the board in the current color
+    to make sure we fill the whole screen */
+    if (rect_func) {
+        rect_func(0, height, width + 1, 1, CELL_SIZE);
+        rect_func(width, 0, 1, height, CELL_SIZE);
+        return;
+    }
+    for (int i = 0; i < width; i++) {
+        fill_func(i, height, CELL_SIZE);
+    }
+    for (int i = 0; i < height; i++) {
+        fill_func(width, i, CELL_SIZE);
+    }
+}
+
+void draw_board(Board* board, int* cells, int count, bool full) {
+    /* Draws the cells that changed since the last frame, or the whole
+    board if everything changed. Nothing changed means nothing is drawn.
+    Runs of same-state cells in a row are drawn as one wide rectangle */
+    // with two framebuffers taking turns, this one also missed the last frame
+    bool replay = fb_buffers() == 2;
+
+    if ((full || (replay && prev_damage_full)) && args->flags & FRAMEBUFFER && !(args->flags & CIRCLE)) {
+        // whole framebuffer frames go through the threaded rasterizer
+        fb_raster(board->pattern, board->width, board->height, pixel_list, num_colors, CELL_SIZE);
+    } else if (full || (replay && prev_damage_full)) {
+        int y = 0;
+        while (y < board->height) {
+            int* row = board->pattern + y * board->width;
+
+            // with -mergerows, identical rows below this one come along too
+            int rows = 1;
+            if (args->flags & MERGE_ROWS) {
+                while (y + rows < board->height
+                       && memcmp(row, row + rows * board->width, board->width * sizeof(int)) == 0) {
+                    rows++;
+                }
+            }
+
+            int x = 0;
+            while (x < board->width) {
+                int end = x + 1;
+                while (end < board->width && row[end] == row[x]) {
+                    end++;
+                }
+                draw_run(board, y * board->width + x, end - x, rows);
+                x = end;
+            }
+            y += rows;
+        }
+        
+        color_pixel(pixel_list[DEAD]);
         cur_color = DEAD;
+        fill_margin(board->width, board->height);
+    } else {
+        draw_cells(board, cells, count);
+        if (replay) {
+            draw_cells(board, prev_damage, prev_damage_count);
+        }
+    }
 
-        // Fill the board right here and now for instant updates!
-        for (int i = 0; i < cur_board->width * cur_board->height; i++) {
-            (*fill_func)(i % cur_board->width, i / cur_board->width, CELL_SIZE);
+    if (replay) {
+        if (prev_damage == NULL) {
+            prev_damage = (int*)malloc(board->width * board->height * sizeof(int));
+        }
+        memcpy(prev_damage, cells, count * sizeof(int));
+        prev_damage_count = count;
+        prev_damage_full = full;
+    }
+}
+
+uint mix_pixels(uint from, uint to, int step, int steps) {
+    /* Mixes two pixels channel by channel, step/steps of the way to to */
+    uint out = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        int a = (from >> shift) & 0xff, b = (to >> shift) & 0xff;
+        out |= (uint)(a + (b - a) * step / steps) << shift;
+    }
+    return out;
+}
+
+void draw_fade(Board* board, int* old_pattern, int* cells, int count, int step, int steps) {
+    /* Draws the changed cells step/steps of the way from their color in
+    old_pattern to their color now, for frames between generations */
+    for (int i = 0; i < count; i++) {
+        int cell = cells[i];
+        uint from = pixel_list[old_pattern[cell] % num_colors];
+        uint to = pixel_list[board->pattern[cell] % num_colors];
+        color_pixel(mix_pixels(from, to, step, steps));
+        fill_func(cell % board->width, cell / board->width, CELL_SIZE);
+    }
+    cur_color = -1; // the blends aren't in color_list
+}
+
+void draw_ants(Board* board, Ant* ants, int origin_x, int origin_y) {
+    /* Draws the ants over the now completed board. Ants are in plane
+    coordinates, the screen is a viewport onto the plane at origin_x, origin_y */
+    if (!(args->flags & ANT)) {
+        return;
+    }
+    // batches reorder cells, so the board has to go out before the ants
+    flush_batches();
+
+    // Loop through the ants and draw them
+    cur_color = -1; // dummy value to let us know we need to reset the color
+    for (int ant_index = 0; ant_index < args->num_ants; ant_index++) {
+        Ant ant = ants[ant_index];
+        int x = ant.x - origin_x;
+        int y = ant.y - origin_y;
+        // skip ants that wandered off screen
+        if (x < 0 || x >= board->width || y < 0 || y >= board->height) {
+            continue;
+        }
+        color(ant.color);
+        fill_func(x, y, CELL_SIZE);
+    }
+}
+
+float count_dead(Board* board) {
+    /* Counts the dead cells on the board */
+    float dead = 0;
+    for (int i = 0; i < board->width * board->height; i++) {
+        if (board->pattern[i] == DEAD) {
+            dead++;
+        }
+    }
+    return dead;
+}
+
+void heat_visit_plane(int x, int y) {
+    /* Visit hook for the ants, maps plane coordinates onto the screen */
+    heat_visit(x - heat_origin_x, y - heat_origin_y);
+}
+
+void draw_heat(Board* board, bool full) {
+    /* Draws the ants' trail-age heatmap. After a full draw, only the
+    cells whose shade changed (or that an ant left) get redrawn */
+    int* cells;
+    int count = heat_take_dirty(&cells);
+
+    if (full) {
+        for (int i = 0; i < board->width * board->height; i++) {
+            int shade = heat_shade(i);
+            if (shade != cur_color) {
+                cur_color = shade;
+                color_pixel(heat_pixels[cur_color]);
+            }
+            fill_func(i % board->width, i / board->width, CELL_SIZE);
+        }
+
+        color_pixel(heat_pixels[HEAT_SHADES - 1]);
+        cur_color = HEAT_SHADES - 1;
+        fill_margin(board->width, board->height);
+        return;
+    }
+
+    for (int i = 0; i < count; i++) {
+        int shade = heat_shade(cells[i]);
+        if (shade != cur_color) {
+            cur_color = shade;
+            color_pixel(heat_pixels[cur_color]);
+        }
+        fill_func(cells[i] % board->width, cells[i] / board->width, CELL_SIZE);
+    }
+}
+
+bool step_simulation(Board* board, int** keep_prev) {
+    /* Generates the next board in place and restocks it if needed. The old
+    pattern goes in *keep_prev if that's given, otherwise it's freed
+    Returns true if the ants' view moved, which the heatmap has to start over for */
+    // count the dead before they change, if we're going to restock
+    float dead = 0;
+    const float total = board->width * board->height;
+    if (!(args->flags & NO_RESTOCK)) {
+        dead = count_dead(board);
+    }
+
+    if (args->flags & HEAT) {
+        heat_tick();
+    }
+    int* next_pattern = (*gen_next)(board->pattern, board->width, board->height);
+    if (keep_prev) {
+        free(*keep_prev);
+        *keep_prev = board->pattern;
+    } else {
+        free(board->pattern);
+    }
+    board->pattern = next_pattern;
+
+    // the heatmap is in screen space, so start over if the view moved
+    bool moved = false;
+    if (args->flags & HEAT) {
+        int origin_x, origin_y;
+        ant_viewport(&origin_x, &origin_y);
+        if (origin_x != heat_origin_x || origin_y != heat_origin_y) {
+            heat_origin_x = origin_x;
+            heat_origin_y = origin_y;
+            heat_reset();
+            moved = true;
+        }
+    }
+
+    // check if we need to add more cells
+    if (args->flags & SEEDS) {
+        // increment iter count
+        iter_count++;
+        // if iter count too high
+        if (iter_count >= 100 && !(args->flags & NO_RESTOCK)) {
+            int* next_pattern = gen_random(board->width, board->height, 20);
+            free(board->pattern);
+            board->pattern = next_pattern;
+            damage_all();
+            iter_count = 0;
+        }
+    } else {
+        // if XX% of the board is dead, add more cells
+        if (dead/total >= restock_thresh && !(args->flags & NO_RESTOCK)) {
+            add_random(board->pattern, board->width, board->height, 20);
+            iter_count = 0;
+        }
+    }
+    return moved;
+}
+
+void print_stats(double draw_ms, double gen_ms) {
+    /* Prints the -stats line for the last STATS_FRAMES frames */
+    fprintf(stderr, "draw %.2f ms, gen %.2f ms per frame, %d missed deadlines\n",
+            draw_ms / STATS_FRAMES, gen_ms / STATS_FRAMES, missed_deadlines);
+    missed_deadlines = 0;
+}
+
+void apply_commands(Board* board) {
+    /* Applies the edits the screen thread sent since last time */
+    int slot;
+    while ((slot = ring_begin_pop(&command_ring)) >= 0) {
+        Command command = commands[slot];
+        ring_end_pop(&command_ring);
+        if (command.type == ADD_CELL) {
+            board->pattern[command.cell] = ALIVE;
+            damage_mark(command.cell);
+        } else {
+            clear_board(board);
         }
+        edits_applied++;
+    }
+}
+
+void* simulate(void* arg) {
+    /* Simulation thread for -pipeline. Publishes each board with what
+    changed to get there, then works on the next one while it's drawn */
+    Board* board = (Board*)arg;
+    int num_cells = board->width * board->height;
+    double gen_ms = 0;
+    while (!atomic_load(&sim_stopping)) {
+        // wait for room in the ring, still taking edits so the screen never blocks on us
+        apply_commands(board);
+        int slot;
+        while ((slot = ring_begin_push(&frame_ring)) < 0) {
+            sem_wait(&sim_wake);
+            if (atomic_load(&sim_stopping)) {
+                return NULL;
+            }
+            apply_commands(board);
+        }
+
+        Frame* frame = &frames[slot];
+        int* cells;
+        frame->full = damage_take(&cells, &frame->count);
+        memcpy(frame->pattern, board->pattern, num_cells * sizeof(int));
+        memcpy(frame->cells, cells, frame->count * sizeof(int));
+        if (args->flags & ANT) {
+            memcpy(frame->ants, args->ants, args->num_ants * sizeof(Ant));
+            ant_viewport(&frame->origin_x, &frame->origin_y);
+        }
+        frame->gen_ms = gen_ms;
+        frame->edits = edits_applied;
+        ring_end_push(&frame_ring);
+        eventfd_write(frame_ready, 1);
+
+        double gen_start = now_ms();
+        step_simulation(board, NULL);
+        gen_ms = now_ms() - gen_start;
+    }
+    return NULL;
+}
+
+void start_simulation(Board* board) {
+    /* Sets up the rings and starts the simulation thread on board */
+    int num_cells = board->width * board->height;
+    ring_init(&frame_ring, PIPELINE_FRAMES);
+    ring_init(&command_ring, PIPELINE_COMMANDS);
+    sem_init(&sim_wake, 0, 0);
+    frame_ready = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (frame_ready < 0) {
+        perror("Failed to create the frame eventfd");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < PIPELINE_FRAMES; i++) {
+        frames[i].pattern = (int*)malloc(num_cells * sizeof(int));
+        frames[i].cells = (int*)malloc(num_cells * sizeof(int));
+        frames[i].ants = (Ant*)malloc((args->num_ants + 1) * sizeof(Ant));
+        frames[i].origin_x = frames[i].origin_y = 0;
+        if (frames[i].pattern == NULL || frames[i].cells == NULL || frames[i].ants == NULL) {
+            perror("Failed to allocate memory for the frame ring");
+            exit(EXIT_FAILURE);
+        }
+    }
+    unsent = (Command*)malloc((num_cells + 1) * sizeof(Command));
+    cell_unsent = (bool*)calloc(num_cells, sizeof(bool));
+    if (unsent == NULL || cell_unsent == NULL) {
+        perror("Failed to allocate memory for the command ring");
+        exit(EXIT_FAILURE);
+    }
+
+    if (pthread_create(&sim_thread, NULL, simulate, board) != 0) {
+        perror("Failed to start the simulation thread");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void stop_simulation() {
+    /* Stops the simulation thread and waits for it, so nothing it uses
+    gets freed out from under it. Frees the frame ring after */
+    atomic_store(&sim_stopping, true);
+    sem_post(&sim_wake); // it might be waiting for room in the ring
+    pthread_join(sim_thread, NULL);
+
+    for (int i = 0; i < PIPELINE_FRAMES; i++) {
+        free(frames[i].pattern);
+        free(frames[i].cells);
+        free(frames[i].ants);
+    }
+    free(unsent);
+    free(cell_unsent);
+    sem_destroy(&sim_wake);
+    close(frame_ready);
+}
+
+void add_stats(double draw_ms, double gen_ms, int gens) {
+    /* Adds a frame to the -stats totals, and prints them every STATS_FRAMES frames */
+    stat_draw_ms += draw_ms;
+    stat_gen_ms += gen_ms;
+    if (++stat_frames == STATS_FRAMES) {
+        print_stats(stat_draw_ms, stat_gen_ms);
+        if (args->flags & GOVERN) {
+            fprintf(stderr, "governor: %d generations per frame, %.1f fps shown\n",
+                    gens, 1e9 / frame_period_ns);
+        }
+        stat_draw_ms = stat_gen_ms = 0;
+        stat_frames = 0;
+    }
+}
+
+void show_frame() {
+    /* Frame for -pipeline. Draws the next board the simulation thread
+    finished, only touching X and never the simulation's state. If it
+    hasn't finished one yet, the frame goes out once frame_ready says so.
+    The simulation runs up to PIPELINE_FRAMES generations ahead, so edits
+    land on a later board than the one on screen; boards generated before
+    they landed would undo them on screen, and are dropped instead */
+    flush_commands();
+    int slot;
+    while ((slot = ring_begin_pop(&frame_ring)) >= 0
+           && frames[slot].edits < edits_sent) {
+        ring_end_pop(&frame_ring);
+        sem_post(&sim_wake);
+        frame_dropped = true;
+    }
+    if (slot < 0) {
+        waiting_for_frame = true;
+        return;
+    }
+    double draw_start = now_ms();
+
+    Frame* frame = &frames[slot];
+    Board shown = {cur_board.width, cur_board.height, frame->pattern};
+    // unless all of it gets redrawn, catch up on cells edited on screen since the last frame
+    bool full = frame->full || frame_dropped;
+    frame_dropped = false;
+    begin_frame(full);
+    draw_board(&shown, frame->cells, frame->count, full);
+    draw_ants(&shown, frame->ants, frame->origin_x, frame->origin_y);
+    double frame_gen_ms = frame->gen_ms;
+    ring_end_pop(&frame_ring);
+    sem_post(&sim_wake);
+
+    present();
+    if (args->flags & STATS) {
+        // make the server finish the frame so its time gets counted
+        x11_sync();
+        add_stats(now_ms() - draw_start, frame_gen_ms, 1);
+    }
+    next_frame(1);
+}
+
+void run_frame() {
+    /* Draws one frame. With -dfps that's one step of the crossfade, until
+    the last step, which draws the generation itself and makes the next one */
+    // get start time
+    double draw_start = now_ms();
+
+    /* DRAWING PORTION */
+    int origin_x = 0, origin_y = 0;
+    if (args->flags & ANT) {
+        ant_viewport(&origin_x, &origin_y);
+    }
+    if (args->flags & HEAT) {
+        if (full_redraw) {
+            begin_frame(true);
+        }
+        draw_heat(&cur_board, full_redraw);
+        full_redraw = false;
+    } else {
+        // with -dfps, fade the changes in over the frames before this generation's
+        int* cells;
+        int count;
+        if (fade_step < fade_steps && prev_pattern && !damage_peek(&cells, &count)) {
+            begin_frame(false);
+            draw_fade(&cur_board, prev_pattern, cells, count, fade_step, fade_steps);
+            draw_ants(&cur_board, args->ants, origin_x, origin_y);
+            present();
+            fade_step++;
+            next_frame(1);
+            return;
+        }
+
+        // draw_board redraws whatever the back buffer missed itself
+        bool full = damage_take(&cells, &count);
+        begin_frame(true);
+        draw_board(&cur_board, cells, count, full);
+    }
+
+    // Handle drawing ants over the now completed board
+    draw_ants(&cur_board, args->ants, origin_x, origin_y);
+
+    // send the frame off
+    present();
+    if (args->flags & (STATS | GOVERN)) {
+        // make the server finish the frame so its time gets counted
+        x11_sync();
+    }
+    double gen_start = now_ms();
+
+    /* GENERATION PORTION */
+    // Now generate the next pattern, keeping this one around to fade from
+    // the governor may run a few at once, their damage adds up for the next frame
+    int gens = args->flags & GOVERN ? governor_gens() : 1;
+    for (int gen = 0; gen < gens; gen++) {
+        if (step_simulation(&cur_board, fade_steps > 1 ? &prev_pattern : NULL)) {
+            full_redraw = true;
+        }
+    }
+    double gen_end = now_ms();
+
+    // pick the next frame's generations and how long to show it from what this one cost
+    if (args->flags & GOVERN) {
+        governor_update(gen_start - draw_start, gen_end - gen_start, gens);
+        frame_period_ns = governor_period_ns();
+    }
+
+    if (args->flags & STATS) {
+        add_stats(gen_start - draw_start, gen_end - gen_start, gens);
+    }
+
+    // show it until the next generation is due, whatever the fade didn't use up
+    int faded_frames = fade_step - 1;
+    fade_step = 1;
+    next_frame(fade_steps - faded_frames);
+}
+
+void frame_due() {
+    /* Draws the next frame, unless frames are stopped */
+    waiting_for_frame = false; // whatever was late is covered by this one
+    // a vsync completion can still land after frames were stopped
+    if (paused || add_mode || suspended) {
+        return;
+    }
+    // nothing to simulate or draw for while nobody can see it
+    if (args->flags & SUSPEND && !window_visible()) {
+        suspend();
+        return;
+    }
+    if (pipelined) {
+        // the simulation thread stops by itself once the ring fills up
+        show_frame();
+    } else {
+        run_frame();
+    }
+}
+
+void on_frame_timer(int fd) {
+    /* The next frame is due */
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+        frame_due();
+    }
+}
+
+void on_frame_ready(int fd) {
+    /* The simulation thread pushed a frame, which is late if one was due */
+    eventfd_t frames_pushed;
+    if (eventfd_read(fd, &frames_pushed) == 0 && waiting_for_frame) {
+        frame_due();
+    }
+}
+
+void on_check_timer(int fd) {
+    /* Looks at whether the window can be seen again, while suspended */
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) == sizeof(expirations)
+        && suspended && window_visible()) {
+        unsuspend();
+    }
+}
+
+void on_x11(int fd) {
+    /* Handles whatever the X server sent. Keybinds and add mode presses
+    go to on_key and on_press, the rest is followed up on here */
+    x11_dispatch();
+    // the window being uncovered sends events, so resume right away
+    if (suspended && window_visible()) {
+        unsuspend();
+    }
+    if (vblank_pending && !present_pending()) {
+        vblank_pending = false;
+        vsync_next();
+    }
+}
+
+void on_signal(int fd) {
+    /* Cleans up on SIGINT or SIGTERM, same as Ctrl-Alt-Q */
+    struct signalfd_siginfo info;
+    if (read(fd, &info, sizeof(info)) == sizeof(info)) {
+        cleanup();
+        exit(0);
     }
 }
 
-/* Could optimize this to only update when the user is looking at it,
-but I'm just not sure how to detect that yet. Looks like in-built event
-handling in X11 but I've been trying for an hour to make it work and
-I cannot. Maybe the answer is to look at the root window and check 
-its events? Cause the root window is overlayed on the sim */
 int main(int argc, char **argv) {
     // parse arguments
     parse_args(argc, argv);
@@ -478,9 +1680,23 @@ int main(int argc, char **argv) {
         }
     }
 
+    // SIGINT and SIGTERM come in through the event loop, so every thread
+    // has to keep them blocked. Threads copy the mask from here
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &signals, NULL);
+    signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+
     // Initialize the window
-    window_setup(args->dead_color);
+    window_setup(args->dead_color, args->flags & ROOT, all_opaque());
     
+    // watch for the window being covered or the screen going dark
+    if (args->flags & SUSPEND) {
+        visibility_setup();
+    }
+
     // Set up add, pause, delete (clear), and quit keybinds
     if (args->flags & KEYBINDS) {
         setup_keybind("A");
@@ -489,12 +1705,83 @@ int main(int argc, char **argv) {
         setup_keybind("D");
     }
 
+    // set up the framebuffer if they asked for it
+    if (args->flags & FRAMEBUFFER && !fb_setup(!(args->flags & NO_SHM))) {
+        fprintf(stderr, "Could not create a framebuffer, drawing with X requests instead\n");
+        args->flags &= ~FRAMEBUFFER;
+    }
+
+    // background priority has to be set before any threads start, so they all get it
+    if (args->flags & IDLE && !throttle_idle()) {
+        fprintf(stderr, "Could not lower the priority, running at normal priority\n");
+    }
+    if (args->cpu_budget > 0) {
+        throttle_setup(args->cpu_budget);
+    }
+
+    // the heatmap already fades on its own
+    if (args->display_fps > args->framerate && !(args->flags & HEAT)) {
+        fade_steps = args->display_fps / args->framerate + 0.5;
+    }
+    float display_fps = args->framerate * fade_steps;
+
+    // pace frames with the display if they asked for it
+    if (args->flags & VSYNC && !present_setup(display_fps)) {
+        fprintf(stderr, "Present extension unavailable, pacing frames with a timer instead\n");
+        args->flags &= ~VSYNC;
+    }
+
+    // the heatmap and crossfades draw from the simulation's own state, so they can't be pipelined
+    if (args->flags & PIPELINE) {
+        if (args->flags & HEAT || fade_steps > 1) {
+            fprintf(stderr, "-pipeline doesn't work with -heat or -dfps, running single-threaded\n");
+        } else {
+            pipelined = true;
+        }
+    }
+
+    // the governor sets its own frame periods, which vsync, crossfades and the pipeline all do their own way
+    if (args->flags & GOVERN) {
+        if (args->flags & VSYNC || fade_steps > 1 || pipelined) {
+            fprintf(stderr, "-budget and -gpf don't work with -vsync, -dfps or -pipeline, running a generation per frame\n");
+            args->flags &= ~GOVERN;
+        } else {
+            governor_setup(args->framerate, args->frame_budget, args->max_gens);
+        }
+    }
+
+    // whole framebuffer frames are split across a thread per core
+    if (args->flags & FRAMEBUFFER && !(args->flags & CIRCLE)) {
+        raster_setup(sysconf(_SC_NPROCESSORS_ONLN), CELL_SIZE);
+    }
+
+    // set up XRender scaling if they asked for it
+    if (args->flags & XRENDER) {
+        if (args->flags & CIRCLE) {
+            fprintf(stderr, "-xrender can only draw squares, drawing with X requests instead\n");
+            args->flags &= ~XRENDER;
+        } else if (!xr_setup(CELL_SIZE)) {
+            fprintf(stderr, "Could not set up XRender, drawing with X requests instead\n");
+            args->flags &= ~XRENDER;
+        }
+    }
+
     // set the fill function based on the flags
-    fill_func = args->flags & CIRCLE ? fill_circle : fill_cell; // (x, y, size)
+    if (args->flags & XRENDER) {
+        fill_func = xr_fill_cell; // (x, y, size)
+        rect_func = xr_fill_rect; // (x, y, w, h, size)
+    } else if (args->flags & FRAMEBUFFER) {
+        fill_func = args->flags & CIRCLE ? fb_fill_circle : fb_fill_cell; // (x, y, size)
+        rect_func = args->flags & CIRCLE ? NULL : fb_fill_rect; // (x, y, w, h, size)
+    } else if (args->flags & BATCH) {
+        batch_setup();
+        fill_func = args->flags & CIRCLE ? batch_fill_circle : batch_fill_cell; // (x, y, size)
+        rect_func = args->flags & CIRCLE ? NULL : batch_fill_rect; // (x, y, w, h, size)
+    } else {
+        fill_func = args->flags & CIRCLE ? fill_circle : fill_cell; // (x, y, size)
+        rect_func = args->flags & CIRCLE ? NULL : fill_rect; // (x, y, w, h, size)
+    }
 
-    int* (*gen_next)(int*, int, int);
-    int* (*gen_random)(int, int, int);
-    void (*add_random)(int*, int, int, int);
     // set the generation functions based on the flags
     if (args->flags & BB) {
         gen_next = bb_gen_next;
@@ -515,10 +1802,9 @@ int main(int argc, char **argv) {
     }
 
     // set the restock threshold based on the flags
-    float restock_thresh = args->flags & BB ? 1.0 : .95;
+    restock_thresh = args->flags & BB ? 1.0 : .95;
 
     // GAME TIME!!!    
-    Board cur_board;
     cur_board.height = screen_height() / CELL_SIZE + 1;
     cur_board.width = screen_width() / CELL_SIZE + 1;
     
@@ -528,9 +1814,8 @@ int main(int argc, char **argv) {
         memset(cur_board.pattern, 0, cur_board.width * cur_board.height * sizeof(int));
     }
 
-    // track how many dead there are
-    float dead = 0;
-    const float total = cur_board.width * cur_board.height;
+    // track which cells need redrawing, starting with all of them
+    damage_init(cur_board.width, cur_board.height);
 
     if (args->flags & ANT) {
         // do ant things
@@ -542,6 +1827,7 @@ int main(int argc, char **argv) {
             args->ants[0].y = cur_board.height / 2;
             args->ants[0].direction = UP;
             args->ants[0].color = (ARGB){255, 255, 0, 0};
+            args->ants[0].state = 0;
 
             // Default color list
             color_list = (ARGB*)malloc(2 * sizeof(ARGB));
@@ -550,12 +1836,33 @@ int main(int argc, char **argv) {
             num_colors = 2;
 
             // Default ruleset
-            ruleset[0] = 'R';
-            ruleset[1] = 'L';
-            ruleset[2] = '\0';
+            ruleset = strdup("RL");
+        }
+        // Initialize the ants, turmites bring their own table
+        if (turmite_rules) {
+            init_turmites(args->ants, args->num_ants, turmite_rules, num_states, num_colors);
+        } else {
+            init_ants(args->ants, args->num_ants, ruleset);
+        }
+        ant_set_steps(args->ant_steps);
+        if (args->flags & UNBOUNDED) {
+            ant_set_unbounded(args->flags & FOLLOW);
+        }
+
+        if (args->flags & HEAT) {
+            // fade from the alive color down to the background
+            for (int j = 0; j < HEAT_SHADES; j++) {
+                ARGB hot = args->alive_color;
+                ARGB cold = color_list[DEAD];
+                int t = HEAT_SHADES - 1;
+                heat_pixels[j] = argb_to_int((ARGB){(hot.a * (t - j) + cold.a * j) / t,
+                                                    (hot.r * (t - j) + cold.r * j) / t,
+                                                    (hot.g * (t - j) + cold.g * j) / t,
+                                                    (hot.b * (t - j) + cold.b * j) / t});
+            }
+            heat_init(cur_board.width, cur_board.height, args->heat_gens, HEAT_SHADES);
+            ant_set_visit_hook(heat_visit_plane);
         }
-        // Initialize the ants
-        init_ants(args->ants, args->num_ants, ruleset);
     } else {
         num_colors = 3;
         color_list = (ARGB*)malloc(3 * sizeof(ARGB));
@@ -564,100 +1871,45 @@ int main(int argc, char **argv) {
         color_list[2] = args->dying_color;
     }
 
+    // pack the colors into pixels once instead of on every color change
+    pixel_list = (uint*)malloc(num_colors * sizeof(uint));
+    for (int j = 0; j < num_colors; j++) {
+        pixel_list[j] = argb_to_int(color_list[j]);
+    }
+
     // set the color to the background color
-    color(color_list[cur_color]);
+    color_pixel(pixel_list[cur_color]);
     cur_color = DEAD;    
 
-    // define iter count
-    int iter_count = 0;
-
-    // Main loop
-    while (1) {
-        // get start time
-        time_t start_time = time(NULL);
-
-        /* DRAWING PORTION */
-        // loop through our board and draw it
-        for (int i = 0; i < cur_board.width * cur_board.height; i++) {
-            // if the color has changed
-            if (cur_board.pattern[i] != cur_color) {
-                // update color accordingly
-                    // % num_colors to allow for ANT's variable number of states
-                cur_color = cur_board.pattern[i] % num_colors; 
-                color(color_list[cur_color]);
-            }
-
-            // increment dead counter if on dead cell
-                // will increment in langton's ant, but will do nothing
-            if (cur_color == DEAD) {
-                dead++;
-            }
-
-            // fill the cell with whatever color we land on
-            fill_func(i % cur_board.width, i / cur_board.width, CELL_SIZE);
-        }
-        
-        color(color_list[DEAD]);
-        cur_color = DEAD;
-        // fill one more row and col with bg to make sure we fill the whole screen
-        for (int i = 0; i < cur_board.width; i++) {
-            fill_func(i, cur_board.height, CELL_SIZE);
-        }
-        for (int i = 0; i < cur_board.height; i++) {
-            fill_func(cur_board.width, i, CELL_SIZE);
-        }
-
-        // Handle drawing ants over the now completed board
-        if (args->flags & ANT) {
-            // Loop through the ants and draw them
-            cur_color = -1; // dummy value to let us know we need to reset the color
-            for (int ant_index = 0; ant_index < args->num_ants; ant_index++) {
-                Ant ant = args->ants[ant_index];
-                color(args->ants[ant_index].color);
-                fill_func(ant.x, ant.y, CELL_SIZE);
-            }
-        }
-
-        /* GENERATION PORTION */
-        // Now generate the next pattern
-        int* next_pattern = (*gen_next)(cur_board.pattern, cur_board.width, cur_board.height);
-        free(cur_board.pattern);
-        cur_board.pattern = next_pattern;
-
-        // check if we need to add more cells
-        if (args->flags & SEEDS) {
-            // increment iter count
-            iter_count++;
-            // if iter count too high
-            if (iter_count >= 100 && !(args->flags & NO_RESTOCK)) {
-                int* next_pattern = gen_random(cur_board.width, cur_board.height, 20);
-                free(cur_board.pattern);
-                cur_board.pattern = next_pattern;
-                iter_count = 0;
-            }
-        } else {
-            // if XX% of the board is dead, add more cells
-            if (dead/total >= restock_thresh && !(args->flags & NO_RESTOCK)) {
-                add_random(cur_board.pattern, cur_board.width, cur_board.height, 20);
-                iter_count = 0;
-            }
-        }
-        // reset dead count
-        dead = 0;
+    // with -pipeline the simulation moves to its own thread and this one only draws
+    if (pipelined) {
+        start_simulation(&cur_board);
+    }
 
+    // everything from here on happens in handlers, waiting costs nothing
+    frame_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    check_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (frame_timer < 0 || check_timer < 0 || signal_fd < 0 || !loop_setup()
+        || !loop_add(x11_fd(), on_x11) || !loop_add(frame_timer, on_frame_timer)
+        || !loop_add(check_timer, on_check_timer) || !loop_add(signal_fd, on_signal)) {
+        perror("Failed to set up the event loop");
+        exit(EXIT_FAILURE);
+    }
+    if (pipelined && !loop_add(frame_ready, on_frame_ready)) {
+        perror("Failed to set up the event loop");
+        exit(EXIT_FAILURE);
+    }
+    input_handlers(on_key, on_press);
 
-        /* EXTRA FEATURES */
-        // keybind processing
-        if (args->flags & KEYBINDS) {
-            handle_keybinds(&cur_board);
-        }
+    // the first frame goes out right away, then one every display period
+    frame_period_ns = 1000000000 / display_fps;
+    pacer_start();
 
-        // sleep for the remainder of the frame time, which is usually 100% of it
-        time_t end_time = time(NULL);
-        int sleep_time = 1000000 / args->framerate - (end_time - start_time);
-        if (sleep_time > 0) {
-            usleep(sleep_time);
-        }
+    // Main loop
+    while (1) {
+        // events Xlib already read off the connection won't wake epoll up, so handle those first
+        on_x11(x11_fd());
+        loop_wait();
     }
 
     // cleanup, not that this is reachable
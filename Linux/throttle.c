@@ -0,0 +1,76 @@
+/* throttle.c
+Keeps simwall in the background. The CPU budget samples how much CPU time
+the whole process (every thread) used over the last second and stretches
+the frame period until that's under the budget. Idle priority lets
+everything else on the machine go first.
+*/
+#define _GNU_SOURCE // SCHED_IDLE
+#include <stdio.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include "throttle.h"
+
+#define SAMPLE_NS 1000000000LL // how long each usage sample covers
+#define MAX_SCALE 50.0 // most the frame period gets stretched, however far over budget
+
+static double budget = 0; // share of one core, 0 for no budget
+static double scale = 1; // frame periods get multiplied by this
+static long long sample_wall = 0, sample_cpu = 0; // when the current sample started
+
+static long long clock_ns(clockid_t clock) {
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+void throttle_setup(float percent) {
+    /* Keeps the process under percent of one core */
+    budget = percent / 100.0;
+    scale = 1;
+    sample_wall = clock_ns(CLOCK_MONOTONIC);
+    sample_cpu = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+void throttle_sample() {
+    /* Call once a frame. Every second, compares the CPU used against the
+    budget and adjusts the frame period scale to match */
+    if (budget <= 0) {
+        return;
+    }
+    long long wall = clock_ns(CLOCK_MONOTONIC);
+    if (wall - sample_wall < SAMPLE_NS) {
+        return;
+    }
+    long long cpu = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+    double usage = (double)(cpu - sample_cpu) / (wall - sample_wall);
+    sample_wall = wall;
+    sample_cpu = cpu;
+
+    // usage goes down about as much as the period goes up, so scale by how far off we are
+    scale *= usage / budget;
+    if (scale < 1) {
+        scale = 1;
+    }
+    if (scale > MAX_SCALE) {
+        scale = MAX_SCALE;
+    }
+}
+
+double throttle_scale() {
+    /* What to multiply frame periods by to stay under the budget */
+    return scale;
+}
+
+bool throttle_idle() {
+    /* Moves the calling thread to idle priority, and every thread it
+    starts after this along with it. Falls back to the highest nice value
+    where SCHED_IDLE doesn't exist. Returns false if neither worked */
+#ifdef SCHED_IDLE
+    struct sched_param param = {0};
+    if (sched_setscheduler(0, SCHED_IDLE, &param) == 0) {
+        return true;
+    }
+#endif
+    return setpriority(PRIO_PROCESS, 0, 19) == 0;
+}
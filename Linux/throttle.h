@@ -0,0 +1,11 @@
+#ifndef THROTTLE_H
+#define THROTTLE_H
+
+#include <stdbool.h>
+
+void throttle_setup(float percent);
+void throttle_sample();
+double throttle_scale();
+bool throttle_idle();
+
+#endif // THROTTLE_H
@@ -22,16 +22,948 @@ static int screen;
 
 // Graphics context for drawing
 static GC gc;
+static ulong cur_pixel; // last color set, for drawing into the framebuffer
+static ulong bg_pixel; // window background, circle sprites are blended onto it
+
+// Visual the window was created with, images have to match it
+static Visual* visual;
+static int depth;
+static ulong pixel_mask = OPAQUE; // bits of a pixel the visual has room for
+
+// Root mode: no window of our own, the back buffer is the desktop background
+static bool root_mode = false;
+
+// Area touched in a framebuffer, empty when x0 >= x1
+typedef struct DirtyBox {
+    int x0, y0, x1, y1;
+} DirtyBox;
+#define EMPTY_BOX ((DirtyBox){INT_MAX, INT_MAX, 0, 0})
+#define BAND_SHIFT 5 // drawn areas are tracked per band of 32 pixel rows
+static int num_bands;
+
+// Server-side copy of the scene. Everything is drawn into it, present()
+// copies what changed to the window, and Expose events are repaired from it
+static Pixmap back_buffer;
+static int buffer_width, buffer_height;
+static DirtyBox* shown_bands = NULL; // per band, drawn but not copied to the window yet
+
+// XFixes: the exact rectangles drawn this frame become the clip region of a
+// single copy, so a compositor only sees those pixels as damaged. Past
+// MAX_SHOWN_RECTS the frame is busy enough that the bands are used instead
+#define MAX_SHOWN_RECTS 2048
+static bool use_regions = false;
+static GC copy_gc; // gets the region as its clip, so drawing isn't clipped
+static XRectangle* shown_rects = NULL;
+static int num_shown_rects = 0; // MAX_SHOWN_RECTS + 1 once it overflowed
+static DirtyBox shown_extents;
+
+// Client-side framebuffer, filled by the fb_* functions and sent by present()
+static XImage* image = NULL;
+static bool frame_begun = false; // something was drawn since the last present()
+static DirtyBox* frame_bands = NULL; // what was drawn since the last present(), per band
+
+// Anti-aliased circles for the framebuffer: one coverage mask per cell size,
+// blended onto the background once per color into a whole-cell sprite
+typedef struct Sprite {
+    ulong pixel;
+    uint* pixels; // circle_size x circle_size
+} Sprite;
+#define CIRCLE_SAMPLES 4 // subsamples per pixel side when building the mask
+static uchar* circle_mask = NULL; // coverage of each pixel, 0 to 255
+static size_t circle_size = 0; // cell size the mask and sprites were built for
+static Sprite* sprites = NULL;
+static int num_sprites = 0, sprite_capacity = 0;
+static Sprite* cur_sprite = NULL; // sprite for the current color, NULL until needed
+
+// MIT-SHM double buffering: two shared images take turns being drawn into
+// while the server reads the other one. image points at the back buffer
+static bool use_shm = false;
+static XImage* shm_images[2];
+static XShmSegmentInfo shm_segments[2];
+static bool shm_attached[2]; // server has mapped the segment
+static bool shm_busy[2]; // server hasn't finished reading it yet
+static DirtyBox* shm_stale[2]; // per band, area drawn into the other buffer since
+static int shm_back = 0; // index of the buffer being drawn into
+static int shm_completion; // event type of ShmCompletion
+static bool shm_failed; // set by the error handler while attaching
+
+// Batching: cells are bucketed by color and sent with one
+// XFillRectangles/XFillArcs per color when the batches are flushed
+typedef struct Batch {
+    ulong pixel;
+    XRectangle* rects;
+    XArc* arcs;
+    int num_rects, num_arcs;
+    int rect_capacity, arc_capacity;
+} Batch;
+static bool batching = false;
+static Batch* batches = NULL;
+static int num_batches = 0; // colors used since the last flush
+static int batches_made = 0; // batches allocated, the ones past num_batches are kept for reuse
+static Batch* cur_batch = NULL; // batch for the current color
+
+#ifdef HAVE_XPRESENT
+// Present: frames go out as PresentPixmap copies of the back buffer at a
+// multiple of the refresh interval, and the loop waits for each one to land
+static bool use_present = false;
+static int present_opcode;
+static uint32_t present_serial = 0;
+static bool present_waiting = false; // a frame or MSC notify is still queued
+static uint64_t present_divisor = 1; // refreshes per frame
+static float present_fps;
+static uint64_t last_msc = 0, last_ust = 0; // from the last completion, to measure the refresh rate
+#endif
+
+// XRender scaling: cells are drawn one pixel each into a small image, which
+// the server scales up by the cell size with a nearest-neighbour transform
+static XImage* cell_image = NULL;
+static Pixmap cell_pixmap;
+static GC cell_gc;
+static Picture cell_picture, back_picture;
+static size_t cell_scale; // cell size the transform was set up for
+static DirtyBox cell_box; // cells drawn since the last present()
+
+// Visibility: the window can't be seen when it's fully obscured, when the
+// windows stacked above it cover the screen, or when the screen is blanked
+// or the session locked
+#define RESTACK_CHECK_MS 250 // most often the stacking order gets walked
+#define SCREEN_CHECK_MS 1000 // how often the screensaver, DPMS and logind get asked
+static bool obscured = false; // from VisibilityNotify
+static bool covered = false; // from the stacking order
+static bool restacked = true; // stacking order changed since it was checked
+static bool blanked = false; // screensaver, locker or monitor off
+static double last_restack_check = 0, last_screen_check = 0;
+static bool has_screensaver = false, has_dpms = false;
+static XScreenSaverInfo* saver_info = NULL;
+#ifdef HAVE_LOGIND
+static sd_bus* system_bus = NULL; // to ask logind whether the session is locked
+#endif
+
+// Input: grabbed keybinds and pointer presses are handed to simwall's handlers
+#define MAX_KEYBINDS 8
+typedef struct Keybind {
+    KeyCode keycode;
+    char* key;
+} Keybind;
+static Keybind keybinds[MAX_KEYBINDS];
+static int num_keybinds = 0;
+static void (*key_handler)(char* key) = NULL;
+static void (*press_handler)(POS pos) = NULL;
 
 /* Functions */
+static void grow_box(DirtyBox* box, int x0, int y0, int x1, int y1) {
+    /* Grows box to also cover x0, y0 to x1, y1 */
+    if (x0 < box->x0) box->x0 = x0;
+    if (y0 < box->y0) box->y0 = y0;
+    if (x1 > box->x1) box->x1 = x1;
+    if (y1 > box->y1) box->y1 = y1;
+}
+
+static void mark_drawn(DirtyBox* bands, int x0, int y0, int x1, int y1) {
+    /* Adds x0, y0 to x1, y1 to the bands it overlaps */
+    for (int band = y0 >> BAND_SHIFT; band <= (y1 - 1) >> BAND_SHIFT; band++) {
+        int band_y0 = band << BAND_SHIFT;
+        int band_y1 = band_y0 + (1 << BAND_SHIFT);
+        grow_box(&bands[band], x0, y0 > band_y0 ? y0 : band_y0, x1, y1 < band_y1 ? y1 : band_y1);
+    }
+}
+
+static bool clip_to_buffer(int* x0, int* y0, int* x1, int* y1) {
+    /* Clips a box to the screen, returns false if nothing is left */
+    if (*x0 < 0) *x0 = 0;
+    if (*y0 < 0) *y0 = 0;
+    if (*x1 > buffer_width) *x1 = buffer_width;
+    if (*y1 > buffer_height) *y1 = buffer_height;
+    return *x0 < *x1 && *y0 < *y1;
+}
+
+static void mark_shown_bands(int x0, int y0, int x1, int y1) {
+    /* Queues x0, y0 to x1, y1 of the back buffer to be copied to the window
+    by the next present() when there's no region to copy through */
+    if (clip_to_buffer(&x0, &y0, &x1, &y1)) {
+        mark_drawn(shown_bands, x0, y0, x1, y1);
+    }
+}
+
+static void note_shown(int x0, int y0, int x1, int y1) {
+    /* Adds x0, y0 to x1, y1 to this frame's exact rectangles */
+    if (!use_regions || num_shown_rects > MAX_SHOWN_RECTS || !clip_to_buffer(&x0, &y0, &x1, &y1)) {
+        return;
+    }
+    if (num_shown_rects == MAX_SHOWN_RECTS) {
+        num_shown_rects++; // too many to be worth it
+        return;
+    }
+    shown_rects[num_shown_rects++] = (XRectangle){x0, y0, x1 - x0, y1 - y0};
+    grow_box(&shown_extents, x0, y0, x1, y1);
+}
+
+static void mark_shown(int x0, int y0, int x1, int y1) {
+    /* Queues x0, y0 to x1, y1 of the back buffer to be copied to the window
+    by the next present(), both as bands and as an exact rectangle */
+    mark_shown_bands(x0, y0, x1, y1);
+    note_shown(x0, y0, x1, y1);
+}
+
 void fill_cell(int x, int y, size_t size) {
     /* Fills a cell at x, y with the current color */
-    XFillRectangle(display, window, gc, x*size, y*size, size, size);
+    XFillRectangle(display, back_buffer, gc, x*size, y*size, size, size);
+    mark_shown(x*size, y*size, (x + 1)*size, (y + 1)*size);
+}
+
+void fill_rect(int x, int y, int w, int h, size_t size) {
+    /* Fills w x h cells starting at x, y with the current color */
+    XFillRectangle(display, back_buffer, gc, x*size, y*size, w*size, h*size);
+    mark_shown(x*size, y*size, (x + w)*size, (y + h)*size);
 }
 
 void fill_circle(int x, int y, size_t size) {
     /* Fills a circle at x, y with the current color */
-    XFillArc(display, window, gc, x*size, y*size, size, size, 0, 360*64);
+    XFillArc(display, back_buffer, gc, x*size, y*size, size, size, 0, 360*64);
+    mark_shown(x*size, y*size, (x + 1)*size, (y + 1)*size);
+}
+
+static Bool is_shm_completion(Display* dpy, XEvent* event, XPointer arg) {
+    /* XIfEvent predicate for MIT-SHM completion events */
+    return event->type == shm_completion;
+}
+
+static void handle_shm_completion(XEvent* event) {
+    /* Marks the buffer the server just finished reading as free */
+    XShmCompletionEvent* done = (XShmCompletionEvent*)event;
+    for (int i = 0; i < 2; i++) {
+        if (shm_segments[i].shmseg == done->shmseg) {
+            shm_busy[i] = false;
+        }
+    }
+}
+
+void begin_frame(bool full) {
+    /* Gets the framebuffer ready to draw a frame. Pass full if everything
+    this buffer missed is about to be redrawn (every cell, or with
+    fb_buffers() == 2 the last two frames' changes), so the back buffer
+    doesn't need to catch up with the front one first. Called on the first
+    fb draw after present() if nobody called it, so drawing is always safe */
+    frame_begun = true;
+    if (!use_shm) {
+        return;
+    }
+
+    // wait for the server to finish reading the buffer we're about to write
+    while (shm_busy[shm_back]) {
+        XEvent event;
+        XIfEvent(display, &event, is_shm_completion, NULL);
+        handle_shm_completion(&event);
+    }
+
+    // bring over whatever was drawn into the front buffer since
+    XImage* front = shm_images[1 - shm_back];
+    for (int band = 0; band < num_bands; band++) {
+        DirtyBox stale = shm_stale[shm_back][band];
+        if (!full && stale.x0 < stale.x1) {
+            for (int y = stale.y0; y < stale.y1; y++) {
+                memcpy(image->data + y * image->bytes_per_line + stale.x0 * 4,
+                       front->data + y * front->bytes_per_line + stale.x0 * 4,
+                       (stale.x1 - stale.x0) * 4);
+            }
+        }
+        shm_stale[shm_back][band] = EMPTY_BOX;
+    }
+}
+
+int fb_buffers() {
+    /* Returns how many framebuffers take turns, 0 without a framebuffer */
+    if (use_shm) {
+        return 2;
+    }
+    return image ? 1 : 0;
+}
+
+static void* grow_array(void* array, int* capacity, size_t item_size) {
+    /* Doubles the capacity of a batch array */
+    *capacity = *capacity ? *capacity * 2 : 256;
+    array = realloc(array, *capacity * item_size);
+    if (array == NULL) {
+        perror("Failed to allocate memory for batch");
+        exit(EXIT_FAILURE);
+    }
+    return array;
+}
+
+static void select_batch(ulong pixel) {
+    /* Points cur_batch at the batch for pixel, taking a new one if needed
+    Fades and heatmaps go through lots of colors, but batches are handed
+    back on every flush, so the search only covers this frame's colors */
+    for (int i = 0; i < num_batches; i++) {
+        if (batches[i].pixel == pixel) {
+            cur_batch = &batches[i];
+            return;
+        }
+    }
+    if (num_batches == batches_made) {
+        batches = (Batch*)realloc(batches, (batches_made + 1) * sizeof(Batch));
+        if (batches == NULL) {
+            perror("Failed to allocate memory for batch");
+            exit(EXIT_FAILURE);
+        }
+        memset(&batches[batches_made++], 0, sizeof(Batch));
+    }
+    // reuse whatever arrays the batch had from an earlier color
+    cur_batch = &batches[num_batches++];
+    cur_batch->pixel = pixel;
+}
+
+void batch_fill_rect(int x, int y, int w, int h, size_t size) {
+    /* Queues w x h cells starting at x, y in the current color's batch */
+    if (cur_batch->num_rects == cur_batch->rect_capacity) {
+        cur_batch->rects = grow_array(cur_batch->rects, &cur_batch->rect_capacity, sizeof(XRectangle));
+    }
+    cur_batch->rects[cur_batch->num_rects++] = (XRectangle){x*size, y*size, w*size, h*size};
+    mark_shown(x*size, y*size, (x + w)*size, (y + h)*size);
+}
+
+void batch_fill_cell(int x, int y, size_t size) {
+    /* Queues a cell at x, y in the current color's batch */
+    batch_fill_rect(x, y, 1, 1, size);
+}
+
+void batch_fill_circle(int x, int y, size_t size) {
+    /* Queues a circle at x, y in the current color's batch */
+    if (cur_batch->num_arcs == cur_batch->arc_capacity) {
+        cur_batch->arcs = grow_array(cur_batch->arcs, &cur_batch->arc_capacity, sizeof(XArc));
+    }
+    cur_batch->arcs[cur_batch->num_arcs++] = (XArc){x*size, y*size, size, size, 0, 360*64};
+    mark_shown(x*size, y*size, (x + 1)*size, (y + 1)*size);
+}
+
+void flush_batches() {
+    /* Sends every queued cell, one request per color and shape
+    Call between layers that overlap (e.g. board then ants), since
+    batching reorders the cells within a layer */
+    if (!batching) {
+        return;
+    }
+    for (int i = 0; i < num_batches; i++) {
+        Batch* batch = &batches[i];
+        if (batch->num_rects == 0 && batch->num_arcs == 0) {
+            continue;
+        }
+        XSetForeground(display, gc, batch->pixel);
+        // Xlib splits these up if they're bigger than a request can be
+        if (batch->num_rects) {
+            XFillRectangles(display, back_buffer, gc, batch->rects, batch->num_rects);
+        }
+        if (batch->num_arcs) {
+            XFillArcs(display, back_buffer, gc, batch->arcs, batch->num_arcs);
+        }
+        batch->num_rects = batch->num_arcs = 0;
+    }
+    num_batches = 0;
+    select_batch(cur_pixel);
+}
+
+void batch_setup() {
+    /* Turns on batching for the batch_* functions */
+    batching = true;
+    select_batch(cur_pixel);
+}
+
+void fb_fill_rect(int x, int y, int w, int h, size_t size) {
+    /* Fills w x h cells starting at x, y in the framebuffer with the current color */
+    int x0 = x*size, y0 = y*size;
+    int x1 = x0 + w*size, y1 = y0 + h*size;
+    // the board is a bit bigger than the screen, clip the last row and col
+    if (x1 > image->width) {
+        x1 = image->width;
+    }
+    if (y1 > image->height) {
+        y1 = image->height;
+    }
+    if (x0 >= x1 || y0 >= y1) {
+        return;
+    }
+    if (!frame_begun) {
+        begin_frame(false);
+    }
+    mark_drawn(frame_bands, x0, y0, x1, y1);
+    note_shown(x0, y0, x1, y1);
+
+    for (int py = y0; py < y1; py++) {
+        uint* row = (uint*)(image->data + py * image->bytes_per_line);
+        for (int px = x0; px < x1; px++) {
+            row[px] = cur_pixel;
+        }
+    }
+}
+
+void fb_raster(const int* cells, int board_width, int board_height,
+               const uint* palette, int num_colors, size_t size) {
+    /* Draws the whole board into the framebuffer through the threaded
+    rasterizer, cell states index into palette */
+    int width = board_width * size < image->width ? board_width * size : image->width;
+    int height = board_height * size < image->height ? board_height * size : image->height;
+    if (!frame_begun) {
+        begin_frame(false);
+    }
+    mark_drawn(frame_bands, 0, 0, width, height);
+    note_shown(0, 0, width, height);
+    raster_board(cells, board_width, board_height, palette, num_colors, size,
+                 (uint*)image->data, image->bytes_per_line / 4, width, height);
+}
+
+void fb_fill_cell(int x, int y, size_t size) {
+    /* Fills a cell at x, y in the framebuffer with the current color */
+    fb_fill_rect(x, y, 1, 1, size);
+}
+
+static void build_circle_mask(size_t size) {
+    /* Works out how much of each pixel of a size x size cell the circle
+    covers, by sampling a grid of points inside every pixel */
+    for (int i = 0; i < num_sprites; i++) {
+        free(sprites[i].pixels);
+    }
+    num_sprites = 0;
+    cur_sprite = NULL;
+
+    free(circle_mask);
+    circle_mask = (uchar*)malloc(size * size);
+    if (circle_mask == NULL) {
+        perror("Failed to allocate memory for circle mask");
+        exit(EXIT_FAILURE);
+    }
+    circle_size = size;
+
+    double r = size / 2.0;
+    for (int j = 0; j < size; j++) {
+        for (int i = 0; i < size; i++) {
+            int inside = 0;
+            for (int sy = 0; sy < CIRCLE_SAMPLES; sy++) {
+                double dy = j + (sy + 0.5) / CIRCLE_SAMPLES - r;
+                for (int sx = 0; sx < CIRCLE_SAMPLES; sx++) {
+                    double dx = i + (sx + 0.5) / CIRCLE_SAMPLES - r;
+                    inside += dx * dx + dy * dy <= r * r;
+                }
+            }
+            circle_mask[j * size + i] = inside * 255 / (CIRCLE_SAMPLES * CIRCLE_SAMPLES);
+        }
+    }
+}
+
+static Sprite* find_sprite(ulong pixel) {
+    /* Returns the circle sprite for pixel, blending a new one from the
+    mask the first time a color is used */
+    for (int i = 0; i < num_sprites; i++) {
+        if (sprites[i].pixel == pixel) {
+            return &sprites[i];
+        }
+    }
+
+    if (num_sprites == sprite_capacity) {
+        sprites = grow_array(sprites, &sprite_capacity, sizeof(Sprite));
+    }
+    Sprite* sprite = &sprites[num_sprites];
+    sprite->pixel = pixel;
+    sprite->pixels = (uint*)malloc(circle_size * circle_size * sizeof(uint));
+    if (sprite->pixels == NULL) {
+        perror("Failed to allocate memory for circle sprite");
+        exit(EXIT_FAILURE);
+    }
+
+    // mix every channel (alpha too) between the background and the color
+    for (int i = 0; i < circle_size * circle_size; i++) {
+        uint cover = circle_mask[i];
+        uint out = 0;
+        for (int shift = 0; shift < 32; shift += 8) {
+            uint fg = (pixel >> shift) & 0xff;
+            uint bg = (bg_pixel >> shift) & 0xff;
+            out |= ((fg * cover + bg * (255 - cover) + 127) / 255) << shift;
+        }
+        sprite->pixels[i] = out;
+    }
+    num_sprites++;
+    return sprite;
+}
+
+void fb_fill_circle(int x, int y, size_t size) {
+    /* Stamps an anti-aliased circle at x, y into the framebuffer in the
+    current color. The whole cell is written, corners in the background
+    color, so each row is a straight copy out of the color's sprite */
+    if (size != circle_size) {
+        build_circle_mask(size);
+    }
+    if (cur_sprite == NULL) {
+        cur_sprite = find_sprite(cur_pixel);
+    }
+
+    int x0 = x*size, y0 = y*size;
+    if (x0 >= image->width || y0 >= image->height) {
+        return;
+    }
+    int w = x0 + size < image->width ? size : image->width - x0;
+    int h = y0 + size < image->height ? size : image->height - y0;
+    if (!frame_begun) {
+        begin_frame(false);
+    }
+    mark_drawn(frame_bands, x0, y0, x0 + w, y0 + h);
+    note_shown(x0, y0, x0 + w, y0 + h);
+
+    for (int j = 0; j < h; j++) {
+        uint* row = (uint*)(image->data + (y0 + j) * image->bytes_per_line);
+        memcpy(row + x0, cur_sprite->pixels + j * size, w * sizeof(uint));
+    }
+}
+
+void xr_fill_rect(int x, int y, int w, int h, size_t size) {
+    /* Fills w x h cells starting at x, y in the cell image with the current color */
+    int x1 = x + w < cell_image->width ? x + w : cell_image->width;
+    int y1 = y + h < cell_image->height ? y + h : cell_image->height;
+    if (x >= x1 || y >= y1) {
+        return;
+    }
+    grow_box(&cell_box, x, y, x1, y1);
+    note_shown(x * size, y * size, x1 * size, y1 * size);
+
+    for (int py = y; py < y1; py++) {
+        uint* row = (uint*)(cell_image->data + py * cell_image->bytes_per_line);
+        for (int px = x; px < x1; px++) {
+            row[px] = cur_pixel;
+        }
+    }
+}
+
+void xr_fill_cell(int x, int y, size_t size) {
+    /* Fills a cell at x, y in the cell image with the current color */
+    xr_fill_rect(x, y, 1, 1, size);
+}
+
+bool xr_setup(size_t size) {
+    /* Sets up drawing through XRender: a 1 pixel per cell image, a pixmap
+    to upload it to, and a picture of the pixmap that the server scales
+    up by size with nearest-neighbour filtering. Squares only.
+    Returns false if XRender is missing */
+    int event_base, error_base;
+    if (!XRenderQueryExtension(display, &event_base, &error_base)) {
+        return false;
+    }
+    XRenderPictFormat* window_format = XRenderFindVisualFormat(display, visual);
+    // cells match the window, without alpha if it has none
+    XRenderPictFormat* cell_format = XRenderFindStandardFormat(display, depth == 24 ? PictStandardRGB24 : PictStandardARGB32);
+    if (window_format == NULL || cell_format == NULL) {
+        return false;
+    }
+
+    // one more col and row than the board for the background fill
+    int width = screen_width() / size + 2, height = screen_height() / size + 2;
+    char* data = (char*)calloc(width * height, 4);
+    if (data == NULL) {
+        return false;
+    }
+    cell_image = XCreateImage(display, visual, depth, ZPixmap, 0, data, width, height, 32, 0);
+    if (cell_image == NULL || cell_image->bits_per_pixel != 32) {
+        fprintf(stderr, "Unsupported cell image format\n");
+        if (cell_image) {
+            XDestroyImage(cell_image); // also frees data
+            cell_image = NULL;
+        } else {
+            free(data);
+        }
+        return false;
+    }
+    uint one = 1;
+    cell_image->byte_order = *(uchar*)&one ? LSBFirst : MSBFirst;
+
+    cell_pixmap = XCreatePixmap(display, back_buffer, width, height, cell_format->depth);
+    cell_gc = XCreateGC(display, cell_pixmap, 0, NULL);
+    cell_picture = XRenderCreatePicture(display, cell_pixmap, cell_format, 0, NULL);
+    back_picture = XRenderCreatePicture(display, back_buffer, window_format, 0, NULL);
+
+    // dividing by size through the homogeneous coordinate keeps it exact
+    XTransform scale = {{
+        {XDoubleToFixed(1), 0, 0},
+        {0, XDoubleToFixed(1), 0},
+        {0, 0, XDoubleToFixed(size)}
+    }};
+    XRenderSetPictureTransform(display, cell_picture, &scale);
+    XRenderSetPictureFilter(display, cell_picture, FilterNearest, NULL, 0);
+    cell_scale = size;
+    cell_box = EMPTY_BOX;
+    return true;
+}
+
+static void xr_present() {
+    /* Uploads the cells drawn this frame and has the server scale them
+    into the back buffer, one XPutImage and one XRenderComposite per frame */
+    if (cell_box.x0 < cell_box.x1) {
+        int w = cell_box.x1 - cell_box.x0, h = cell_box.y1 - cell_box.y0;
+        XPutImage(display, cell_pixmap, cell_gc, cell_image, cell_box.x0, cell_box.y0,
+                  cell_box.x0, cell_box.y0, w, h);
+        // source coordinates go through the transform, so they're in window pixels too
+        XRenderComposite(display, PictOpSrc, cell_picture, None, back_picture,
+                         cell_box.x0 * cell_scale, cell_box.y0 * cell_scale, 0, 0,
+                         cell_box.x0 * cell_scale, cell_box.y0 * cell_scale,
+                         w * cell_scale, h * cell_scale);
+        mark_shown_bands(cell_box.x0 * cell_scale, cell_box.y0 * cell_scale,
+                         cell_box.x1 * cell_scale, cell_box.y1 * cell_scale);
+        cell_box = EMPTY_BOX;
+    }
+}
+
+static int shm_error_handler(Display* dpy, XErrorEvent* error) {
+    /* Catches a failed XShmAttach, e.g. on a remote display */
+    shm_failed = true;
+    return 0;
+}
+
+static bool shm_setup(int width, int height) {
+    /* Creates the two shared memory images, returns false if MIT-SHM
+    isn't usable so the caller can fall back to a plain XImage */
+    if (!XShmQueryExtension(display)) {
+        return false;
+    }
+    shm_completion = XShmGetEventBase(display) + ShmCompletion;
+
+    for (int i = 0; i < 2; i++) {
+        XShmSegmentInfo* segment = &shm_segments[i];
+        shm_images[i] = XShmCreateImage(display, visual, depth, ZPixmap, NULL, segment, width, height);
+        if (shm_images[i] == NULL || shm_images[i]->bits_per_pixel != 32) {
+            return false;
+        }
+
+        segment->shmid = shmget(IPC_PRIVATE, shm_images[i]->bytes_per_line * height, IPC_CREAT | 0600);
+        if (segment->shmid < 0) {
+            return false;
+        }
+        segment->shmaddr = shm_images[i]->data = shmat(segment->shmid, NULL, 0);
+        if (segment->shmaddr == (char*)-1) {
+            // never tell the server about a segment we couldn't map ourselves
+            shmctl(segment->shmid, IPC_RMID, NULL);
+            return false;
+        }
+        segment->readOnly = False;
+
+        // attaching fails asynchronously, so sync with a handler in place
+        shm_failed = false;
+        int (*old_handler)(Display*, XErrorEvent*) = XSetErrorHandler(shm_error_handler);
+        XShmAttach(display, segment);
+        XSync(display, False);
+        XSetErrorHandler(old_handler);
+
+        // the segment goes away once both sides detach
+        shmctl(segment->shmid, IPC_RMID, NULL);
+        if (shm_failed) {
+            return false;
+        }
+        shm_attached[i] = true;
+        shm_busy[i] = false;
+    }
+    return true;
+}
+
+static void shm_cleanup() {
+    /* Detaches and frees the shared images */
+    for (int i = 0; i < 2; i++) {
+        if (shm_images[i] == NULL) {
+            continue;
+        }
+        if (shm_attached[i]) {
+            XShmDetach(display, &shm_segments[i]);
+            shm_attached[i] = false;
+        }
+        if (shm_images[i]->data && shm_images[i]->data != (char*)-1) {
+            shmdt(shm_segments[i].shmaddr);
+        }
+        shm_images[i]->data = NULL; // not malloc'd, keep XDestroyImage off it
+        XDestroyImage(shm_images[i]);
+        shm_images[i] = NULL;
+    }
+    use_shm = false;
+}
+
+bool fb_setup(bool allow_shm) {
+    /* Creates a screen-sized framebuffer for the fb_* functions
+    Uses MIT-SHM when allowed and available, otherwise a plain XImage
+    Returns false if it couldn't be made */
+    int width = screen_width(), height = screen_height();
+
+    // drawn and stale areas are kept per band
+    frame_bands = (DirtyBox*)malloc(num_bands * sizeof(DirtyBox));
+    shm_stale[0] = (DirtyBox*)malloc(num_bands * sizeof(DirtyBox));
+    shm_stale[1] = (DirtyBox*)malloc(num_bands * sizeof(DirtyBox));
+    if (frame_bands == NULL || shm_stale[0] == NULL || shm_stale[1] == NULL) {
+        return false;
+    }
+    for (int band = 0; band < num_bands; band++) {
+        frame_bands[band] = shm_stale[0][band] = shm_stale[1][band] = EMPTY_BOX;
+    }
+
+    if (allow_shm) {
+        if (shm_setup(width, height)) {
+            use_shm = true;
+            shm_back = 0;
+            image = shm_images[shm_back];
+            return true;
+        }
+        shm_cleanup();
+        fprintf(stderr, "MIT-SHM unavailable, sending frames over the socket\n");
+    }
+
+    char* data = (char*)calloc(width * height, 4);
+    if (data == NULL) {
+        return false;
+    }
+    image = XCreateImage(display, visual, depth, ZPixmap, 0, data, width, height, 32, 0);
+    if (image == NULL || image->bits_per_pixel != 32) {
+        fprintf(stderr, "Unsupported framebuffer format\n");
+        if (image) {
+            XDestroyImage(image); // also frees data
+            image = NULL;
+        } else {
+            free(data);
+        }
+        return false;
+    }
+
+    // we write pixels as native ints, let Xlib swap them if the server differs
+    uint one = 1;
+    image->byte_order = *(uchar*)&one ? LSBFirst : MSBFirst;
+    return true;
+}
+
+static void put_box(DirtyBox box, bool last) {
+    /* Sends one drawn box of the framebuffer to the back buffer
+    With MIT-SHM, the last box of a frame asks for a completion event */
+    if (use_shm) {
+        XShmPutImage(display, back_buffer, gc, image, box.x0, box.y0, box.x0, box.y0,
+                     box.x1 - box.x0, box.y1 - box.y0, last);
+    } else {
+        XPutImage(display, back_buffer, gc, image, box.x0, box.y0, box.x0, box.y0,
+                  box.x1 - box.x0, box.y1 - box.y0);
+    }
+    mark_shown_bands(box.x0, box.y0, box.x1, box.y1);
+}
+
+static void fb_present() {
+    /* Sends the framebuffer's drawn bands, one (Shm)PutImage each */
+    if (use_shm) {
+        // pick up completions so the queue doesn't fill with them
+        XEvent event;
+        while (XCheckIfEvent(display, &event, is_shm_completion, NULL)) {
+            handle_shm_completion(&event);
+        }
+    }
+
+    // send each drawn band, holding one back so we know which is last
+    DirtyBox pending = EMPTY_BOX;
+    for (int band = 0; band < num_bands; band++) {
+        DirtyBox box = frame_bands[band];
+        if (box.x0 >= box.x1) {
+            continue;
+        }
+        if (pending.x0 < pending.x1) {
+            put_box(pending, false);
+        }
+        pending = box;
+
+        // with two buffers, the other one is now missing this
+        if (use_shm) {
+            grow_box(&shm_stale[1 - shm_back][band], box.x0, box.y0, box.x1, box.y1);
+        }
+        frame_bands[band] = EMPTY_BOX;
+    }
+
+    if (pending.x0 < pending.x1) {
+        put_box(pending, true);
+        if (use_shm) {
+            // swap, the server reads this one while we draw the other
+            shm_busy[shm_back] = true;
+            shm_back = 1 - shm_back;
+            image = shm_images[shm_back];
+        }
+    }
+
+    frame_begun = false;
+}
+
+static bool copy_shown_region() {
+    /* Copies this frame's exact rectangles to the window as one clipped
+    copy. Returns false if there's no usable list, so the bands get copied */
+    int count = num_shown_rects;
+    num_shown_rects = 0;
+    DirtyBox extents = shown_extents;
+    shown_extents = EMPTY_BOX;
+    if (!use_regions || root_mode || count == 0 || count > MAX_SHOWN_RECTS) {
+        return false;
+    }
+
+    XserverRegion region = XFixesCreateRegion(display, shown_rects, count);
+    XFixesSetGCClipRegion(display, copy_gc, 0, 0, region);
+    XCopyArea(display, back_buffer, window, copy_gc, extents.x0, extents.y0,
+              extents.x1 - extents.x0, extents.y1 - extents.y0, extents.x0, extents.y0);
+    XFixesDestroyRegion(display, region);
+
+    for (int band = 0; band < num_bands; band++) {
+        shown_bands[band] = EMPTY_BOX;
+    }
+    return true;
+}
+
+static void copy_shown() {
+    /* Copies everything drawn into the back buffer since last time to the
+    window. Without a region, bands drawn across the same columns are
+    copied together */
+    if (copy_shown_region()) {
+        return;
+    }
+    DirtyBox pending = EMPTY_BOX;
+    bool background_set = false;
+    for (int band = 0; band <= num_bands; band++) {
+        DirtyBox box = band < num_bands ? shown_bands[band] : EMPTY_BOX;
+        if (band < num_bands) {
+            shown_bands[band] = EMPTY_BOX;
+        }
+        if (box.x0 < box.x1 && box.x0 == pending.x0 && box.x1 == pending.x1 && box.y0 == pending.y1) {
+            pending.y1 = box.y1;
+            continue;
+        }
+        if (pending.x0 < pending.x1 && root_mode) {
+            // the server may have kept its own copy of the background when it
+            // was set, so set it again to pick up what was drawn since
+            if (!background_set) {
+                XSetWindowBackgroundPixmap(display, window, back_buffer);
+                background_set = true;
+            }
+            // then the root repaints itself from its background
+            XClearArea(display, window, pending.x0, pending.y0,
+                       pending.x1 - pending.x0, pending.y1 - pending.y0, False);
+        } else if (pending.x0 < pending.x1) {
+            XCopyArea(display, back_buffer, window, gc, pending.x0, pending.y0,
+                      pending.x1 - pending.x0, pending.y1 - pending.y0, pending.x0, pending.y0);
+        }
+        pending = box;
+    }
+}
+
+#ifdef HAVE_XPRESENT
+static void present_shown() {
+    /* Hands what changed to the Present extension, to be copied to the
+    window at the next refresh that's a multiple of present_divisor.
+    Nothing changed still asks to be told when that refresh happens */
+    int count = num_shown_rects;
+    num_shown_rects = 0;
+    shown_extents = EMPTY_BOX;
+    if (count > MAX_SHOWN_RECTS) {
+        // too busy for exact rectangles, use the bands
+        count = 0;
+        for (int band = 0; band < num_bands; band++) {
+            DirtyBox box = shown_bands[band];
+            if (box.x0 < box.x1) {
+                shown_rects[count++] = (XRectangle){box.x0, box.y0, box.x1 - box.x0, box.y1 - box.y0};
+            }
+        }
+    }
+    for (int band = 0; band < num_bands; band++) {
+        shown_bands[band] = EMPTY_BOX;
+    }
+
+    present_serial++;
+    if (count == 0) {
+        XPresentNotifyMSC(display, window, present_serial, 0, present_divisor, 0);
+    } else {
+        // copy rather than flip, the back buffer is drawn into incrementally
+        XserverRegion update = XFixesCreateRegion(display, shown_rects, count);
+        XPresentPixmap(display, window, back_buffer, present_serial, None, update, 0, 0,
+                       None, None, None, PresentOptionCopy, 0, present_divisor, 0, NULL, 0);
+        XFixesDestroyRegion(display, update);
+    }
+    present_waiting = true;
+}
+
+static Bool is_present_event(Display* dpy, XEvent* event, XPointer arg) {
+    /* XIfEvent predicate for Present extension events */
+    return event->type == GenericEvent && event->xcookie.extension == present_opcode;
+}
+
+static void handle_present_event(XEvent* event) {
+    /* Notes when our last frame landed and how fast the screen refreshes */
+    if (!XGetEventData(display, &event->xcookie)) {
+        return;
+    }
+    if (event->xcookie.evtype == PresentCompleteNotify) {
+        XPresentCompleteNotifyEvent* done = (XPresentCompleteNotifyEvent*)event->xcookie.data;
+        if (last_msc && done->msc > last_msc) {
+            // refreshes per frame, rounded, so frames stay on exact multiples of the interval
+            double refresh_hz = 1e6 * (done->msc - last_msc) / (double)(done->ust - last_ust);
+            uint64_t divisor = refresh_hz / present_fps + 0.5;
+            present_divisor = divisor > 0 ? divisor : 1;
+        }
+        last_msc = done->msc;
+        last_ust = done->ust;
+        if (done->serial_number == present_serial) {
+            present_waiting = false;
+        }
+    }
+    XFreeEventData(display, &event->xcookie);
+}
+#endif
+
+bool present_pending() {
+    /* Returns true until the last frame made it to the screen */
+#ifdef HAVE_XPRESENT
+    return use_present && present_waiting;
+#else
+    return false;
+#endif
+}
+
+bool present_setup(float fps) {
+    /* Switches present() over to the Present extension, so frames are
+    shown on vblank at fps rounded to a whole number of refreshes
+    Returns false if Present isn't there, then pace frames with a timer */
+#ifdef HAVE_XPRESENT
+    int event_base, error_base, major = 0, minor = 0;
+    if (root_mode || !use_regions
+        || !XPresentQueryExtension(display, &present_opcode, &event_base, &error_base)
+        || !XPresentQueryVersion(display, &major, &minor)) {
+        return false;
+    }
+    XPresentSelectInput(display, window, PresentCompleteNotifyMask);
+    present_fps = fps;
+    // assume 60 Hz until the first two frames say otherwise
+    uint64_t divisor = 60 / fps + 0.5;
+    present_divisor = divisor > 0 ? divisor : 1;
+    use_present = true;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void present() {
+    /* Sends the finished frame to the X server and shows it. With a
+    framebuffer that's one (Shm)PutImage per band that was drawn in, with
+    batching it's the remaining batches, with XRender one scaled copy of the
+    drawn cells. Then what changed is copied from the back buffer to the
+    window. Nothing drawn means nothing sent */
+    flush_batches();
+    if (cell_image) {
+        xr_present();
+    } else if (image) {
+        fb_present();
+    }
+#ifdef HAVE_XPRESENT
+    if (use_present) {
+        present_shown();
+        XFlush(display);
+        return;
+    }
+#endif
+    copy_shown();
+    XFlush(display);
+}
+
+void x11_sync() {
+    /* Waits until the X server has processed everything sent so far */
+    XSync(display, False);
 }
 
 int screen_width() {
@@ -46,12 +978,24 @@ int screen_height() {
 
 int argb_to_int(ARGB argb) {
     /* Converts an ARGB struct to an int for X11 compatibility */
-    return argb.a << 24 | argb.r << 16 | argb.g << 8 | argb.b;
+    return (argb.a << 24 | argb.r << 16 | argb.g << 8 | argb.b) & pixel_mask;
 }
 
 void color(ARGB argb) {
     /* Sets foreground paint color using ARGB struct */
-    XSetForeground(display, gc, argb_to_int(argb));
+    color_pixel(argb_to_int(argb));
+}
+
+void color_pixel(uint pixel) {
+    /* Sets foreground paint color from an already packed pixel */
+    cur_pixel = pixel;
+    cur_sprite = NULL;
+    if (batching) {
+        // batches set their own color when they're sent
+        select_batch(cur_pixel);
+        return;
+    }
+    XSetForeground(display, gc, cur_pixel);
 }
 
 void raise_window() {
@@ -79,77 +1023,333 @@ void flush() {
     XFlush(display);
 }
 
+static void set_root_pixmap(Pixmap pixmap) {
+    /* Tells other clients (e.g. terminals faking transparency) which pixmap
+    the desktop background is, or that there isn't one if pixmap is None */
+    Atom props[2] = {ATOM(_XROOTPMAP_ID), ATOM(ESETROOT_PMAP_ID)};
+    for (int i = 0; i < 2; i++) {
+        if (pixmap == None) {
+            XDeleteProperty(display, window, props[i]);
+        } else {
+            XChangeProperty(display, window, props[i], XA_PIXMAP, 32, PropModeReplace, (uchar*)&pixmap, 1);
+        }
+    }
+}
+
 void x11_cleanup() {
     /* Cleans everything up, be sure to call when done */
+#ifdef HAVE_LOGIND
+    sd_bus_unref(system_bus);
+#endif
+    if (use_shm) {
+        shm_cleanup();
+    } else if (image) {
+        XDestroyImage(image);
+    }
+    if (cell_image) {
+        XRenderFreePicture(display, cell_picture);
+        XRenderFreePicture(display, back_picture);
+        XFreePixmap(display, cell_pixmap);
+        XFreeGC(display, cell_gc);
+        XDestroyImage(cell_image);
+    }
+    free(frame_bands);
+    free(shown_bands);
+    free(shown_rects);
+    if (use_regions) {
+        XFreeGC(display, copy_gc);
+    }
+    if (root_mode) {
+        // the root keeps showing the last frame, but the pixmap id is about to go away
+        set_root_pixmap(None);
+    }
+    XFreePixmap(display, back_buffer);
+    free(shm_stale[0]);
+    free(shm_stale[1]);
+    free(circle_mask);
+    for (int i = 0; i < num_sprites; i++) {
+        free(sprites[i].pixels);
+    }
+    free(sprites);
+    for (int i = 0; i < batches_made; i++) {
+        free(batches[i].rects);
+        free(batches[i].arcs);
+    }
+    free(batches);
     XFreeGC(display, gc);
-    XDestroyWindow(display, window);
+    if (!root_mode) {
+        XDestroyWindow(display, window);
+    }
     XCloseDisplay(display);
 }
 
-POS get_mouse_pos() {
-    /* Returns true if the left mouse button is pressed */
-    Window child; // child window the pointer is in, if any
-    Window root; // root window the pointer is in
-    int root_x, root_y; // pointer position relative to the root window
-    int win_x, win_y; // pointer position relative to the window
-    unsigned int button_state; // state of the modifier keys and the buttons as a bitmask
-    
-    // Query the pointer state
-    XQueryPointer(display, window, &root, &child, &root_x, &root_y, &win_x, &win_y, &button_state);
-    
-    // Return the position
-    POS pos = {win_x, win_y};
-    return pos;
-}
-
-bool is_lmb_pressed() {
-    /* Returns true if the left mouse button is pressed */
-    Window child; // child window the pointer is in, if any
-    Window root; // root window the pointer is in
-    int root_x, root_y; // pointer position relative to the root window
-    int win_x, win_y; // pointer position relative to the window
-    unsigned int button_state; // state of the modifier keys and the buttons as a bitmask
-    
-    // Query the pointer state
-    XQueryPointer(display, window, &root, &child, &root_x, &root_y, &win_x, &win_y, &button_state);
-    
-    // Check if lmb is being pressed
-    if (button_state & Button1Mask) {
+static void repair_expose(XExposeEvent* expose) {
+    /* Copies an exposed part of the window back from the back buffer */
+    XCopyArea(display, back_buffer, window, gc, expose->x, expose->y,
+              expose->width, expose->height, expose->x, expose->y);
+}
+
+static double clock_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+static bool handle_visibility_event(XEvent* event) {
+    /* Keeps track of the events the visibility checks listen for
+    Returns false if the event is something else */
+    if (event->type == VisibilityNotify) {
+        obscured = event->xvisibility.state == VisibilityFullyObscured;
+        return true;
+    }
+    if (event->type == ConfigureNotify || event->type == MapNotify || event->type == UnmapNotify
+        || event->type == CreateNotify || event->type == DestroyNotify
+        || event->type == ReparentNotify || event->type == CirculateNotify) {
+        restacked = true;
         return true;
     }
     return false;
 }
 
-bool check_for_keybind(char* key) {
-    KeyCode keycode = XKeysymToKeycode(display, XStringToKeysym(key));
-    /* Checks for the keybind and returns true if one is found */
-    XEvent event;
-    if (XCheckMaskEvent(display, KeyPressMask, &event)) {
-        if (event.xkey.keycode == keycode) {
-            return true;
-        } else {
-            XPutBackEvent(display, &event);
+static Window top_level(Window root) {
+    /* Our window, or whatever the window manager framed it in */
+    Window current = window, parent, root_return, *children;
+    uint count;
+    while (XQueryTree(display, current, &root_return, &parent, &children, &count)) {
+        if (children) {
+            XFree(children);
+        }
+        if (parent == root || parent == None) {
+            break;
+        }
+        current = parent;
+    }
+    return current;
+}
+
+static bool screen_covered() {
+    /* Walks the windows stacked above ours and checks if they cover the
+    whole screen between them, like a fullscreen program or a screen locker
+    With -root that's any window over the whole desktop, a desktop icon
+    window included, since the background is hidden under it then */
+    Window root = RootWindow(display, screen);
+    Window root_return, parent, *children;
+    uint count;
+    if (!XQueryTree(display, root, &root_return, &parent, &children, &count)) {
+        return false;
+    }
+
+    // children come bottom to top, on the root everything is above us
+    Window ours = root_mode ? None : top_level(root);
+    bool above = root_mode;
+    XRectangle whole = {0, 0, buffer_width, buffer_height};
+    XserverRegion uncovered = use_regions ? XFixesCreateRegion(display, &whole, 1) : None;
+    bool full = false;
+    for (uint i = 0; i < count && !full; i++) {
+        if (children[i] == ours) {
+            above = true;
+            continue;
+        }
+        XWindowAttributes attrs;
+        if (!above || !XGetWindowAttributes(display, children[i], &attrs)
+            || attrs.map_state != IsViewable || attrs.class == InputOnly) {
+            continue;
+        }
+        // managed windows with an alpha channel are opaque apps under a compositor, but
+        // override-redirect ones are OSDs and overlays that might show us through
+        if (attrs.depth == 32 && attrs.override_redirect) {
+            continue;
+        }
+        int border = attrs.border_width;
+        XRectangle rect = {attrs.x, attrs.y, attrs.width + 2 * border, attrs.height + 2 * border};
+        full = rect.x <= 0 && rect.y <= 0
+            && rect.x + rect.width >= buffer_width && rect.y + rect.height >= buffer_height;
+        if (uncovered) {
+            XserverRegion region = XFixesCreateRegion(display, &rect, 1);
+            XFixesSubtractRegion(display, uncovered, uncovered, region);
+            XFixesDestroyRegion(display, region);
+        }
+    }
+    if (children) {
+        XFree(children);
+    }
+
+    // with XFixes, windows that only cover the screen together count too
+    if (uncovered) {
+        int num_rects;
+        XRectangle bounds;
+        XRectangle* rects = XFixesFetchRegionAndBounds(display, uncovered, &num_rects, &bounds);
+        if (rects) {
+            XFree(rects);
         }
+        full = full || num_rects == 0;
+        XFixesDestroyRegion(display, uncovered);
+    }
+    return full;
+}
+
+static bool session_locked() {
+    /* Asks logind whether our session is locked. Lockers set LockedHint
+    whether or not they blank the screen or map a window we'd see. Built
+    without libsystemd, the screensaver and stacking checks stand in */
+#ifdef HAVE_LOGIND
+    int locked = 0;
+    if (system_bus && sd_bus_get_property_trivial(system_bus, "org.freedesktop.login1",
+            "/org/freedesktop/login1/session/auto", "org.freedesktop.login1.Session",
+            "LockedHint", NULL, 'b', &locked) >= 0) {
+        return locked;
     }
+#endif
     return false;
 }
 
-bool wait_for_keybind(char* key) {
-    /* Waits for the keybind and returns true if one is found */
-    KeyCode keycode = XKeysymToKeycode(display, XStringToKeysym(key));
+static bool screen_blanked() {
+    /* Checks for the screensaver (which lockers use too), the monitor
+    being powered down and the session being locked */
+    if (session_locked()) {
+        return true;
+    }
+    if (has_screensaver && XScreenSaverQueryInfo(display, RootWindow(display, screen), saver_info)
+        && saver_info->state == ScreenSaverOn) {
+        return true;
+    }
+    CARD16 power_level;
+    BOOL enabled;
+    if (has_dpms && DPMSInfo(display, &power_level, &enabled) && enabled
+        && power_level != DPMSModeOn) {
+        return true;
+    }
+    return false;
+}
+
+bool window_visible() {
+    /* Returns false while nobody can see the window. Cheap enough to
+    call every frame, the server only gets asked every so often */
     XEvent event;
-    while (true) {
-        XNextEvent(display, &event);
-        if (event.xkey.keycode == keycode && event.type == KeyPress) {
-            return true;
-        }
+    while (XCheckMaskEvent(display, VisibilityChangeMask | SubstructureNotifyMask, &event)) {
+        handle_visibility_event(&event);
+    }
+
+    double now = clock_ms();
+    if (restacked && now - last_restack_check >= RESTACK_CHECK_MS) {
+        covered = screen_covered();
+        restacked = false;
+        last_restack_check = now;
     }
+    if (now - last_screen_check >= SCREEN_CHECK_MS) {
+        blanked = screen_blanked();
+        last_screen_check = now;
+    }
+    return !obscured && !covered && !blanked;
+}
+
+void visibility_setup() {
+    /* Starts listening for the window getting covered and uncovered */
+    Window root = RootWindow(display, screen);
+    if (!root_mode) {
+        XWindowAttributes attrs;
+        XGetWindowAttributes(display, window, &attrs);
+        XSelectInput(display, window, attrs.your_event_mask | VisibilityChangeMask);
+    }
+    // top level windows coming, going and restacking
+    XSelectInput(display, root, SubstructureNotifyMask);
+
+    int event_base, error_base;
+    if (XScreenSaverQueryExtension(display, &event_base, &error_base)) {
+        saver_info = XScreenSaverAllocInfo();
+        has_screensaver = saver_info != NULL;
+    }
+    has_dpms = DPMSQueryExtension(display, &event_base, &error_base) && DPMSCapable(display);
+#ifdef HAVE_LOGIND
+    if (sd_bus_open_system(&system_bus) < 0) {
+        system_bus = NULL;
+    }
+#endif
 }
 
 void setup_keybind(char* key) {
-    /* Sets up the keybind for the window */
+    /* Sets up the keybind for the window. Pressing it hands key to the key handler */
     KeyCode keycode = XKeysymToKeycode(display, XStringToKeysym(key));
     XGrabKey(display, keycode, ControlMask | Mod1Mask, DefaultRootWindow(display), True, GrabModeAsync, GrabModeAsync);
+    if (num_keybinds < MAX_KEYBINDS) {
+        keybinds[num_keybinds++] = (Keybind){keycode, key};
+    }
+}
+
+void input_handlers(void (*on_key)(char* key), void (*on_press)(POS pos)) {
+    /* Sets what gets called for keybinds, and for the left button being
+    pressed or dragged while the pointer is grabbed */
+    key_handler = on_key;
+    press_handler = on_press;
+}
+
+void grab_pointer(bool grab) {
+    /* Takes the pointer so presses anywhere on screen come to us as events,
+    or gives it back */
+    if (grab) {
+        XGrabPointer(display, window, False, ButtonPressMask | ButtonMotionMask,
+                     GrabModeAsync, GrabModeAsync, None, None, CurrentTime);
+    } else {
+        XUngrabPointer(display, CurrentTime);
+    }
+    XFlush(display);
+}
+
+int x11_fd() {
+    /* The connection to the X server, readable when events come in */
+    return ConnectionNumber(display);
+}
+
+void x11_dispatch() {
+    /* Handles every event that's come in without waiting for more, and
+    sends out anything still buffered. Keybinds and pointer presses go to
+    the handlers, everything else is taken care of here */
+    XEvent event;
+    bool exposed = false;
+    while (XPending(display)) {
+        XNextEvent(display, &event);
+        // keep track of the shared buffers and the last frame
+        if (use_shm && event.type == shm_completion) {
+            handle_shm_completion(&event);
+            continue;
+        }
+#ifdef HAVE_XPRESENT
+        if (use_present && is_present_event(display, &event, NULL)) {
+            handle_present_event(&event);
+            continue;
+        }
+#endif
+        if (handle_visibility_event(&event)) {
+            continue;
+        }
+        switch (event.type) {
+        case Expose:
+            // parts of the window that got uncovered are copied back from the back buffer
+            repair_expose(&event.xexpose);
+            exposed = true;
+            break;
+        case KeyPress:
+            for (int i = 0; i < num_keybinds; i++) {
+                if (keybinds[i].keycode == event.xkey.keycode && key_handler) {
+                    key_handler(keybinds[i].key);
+                }
+            }
+            break;
+        case ButtonPress:
+            if (event.xbutton.button == Button1 && press_handler) {
+                press_handler((POS){event.xbutton.x, event.xbutton.y});
+            }
+            break;
+        case MotionNotify:
+            if (event.xmotion.state & Button1Mask && press_handler) {
+                press_handler((POS){event.xmotion.x, event.xmotion.y});
+            }
+            break;
+        }
+    }
+    if (exposed) {
+        XFlush(display);
+    }
 }
 
 Window* get_window() {
@@ -157,56 +1357,112 @@ Window* get_window() {
     return &window;
 }
 
-Display* window_setup(ARGB bg_color) {
+Display* window_setup(ARGB bg_color, bool on_root, bool opaque) {
     /* Main helper function to run here. Will do all the window setup
+    With on_root, nothing is created and the back buffer becomes the root
+    window's background instead, for window managers without a compositor
+    With opaque (no color has alpha), the window gets a plain 24-bit visual
+    so a compositor doesn't have to blend it
     Returns up a pointer to the display if you want it */
     display = XOpenDisplay(NULL);
     screen = DefaultScreen(display);
     Window root = RootWindow(display, screen);
 
-    // Find an ARGB visual for transparency
-    XVisualInfo vinfo;
-    if (!XMatchVisualInfo(display, screen, 32, TrueColor, &vinfo)) {
-        fprintf(stderr, "No ARGB visual found.\n");
-        return NULL;
-    }
+    if (on_root) {
+        // draw in whatever visual the root has, alpha has nowhere to go
+        root_mode = true;
+        window = root;
+        visual = DefaultVisual(display, screen);
+        depth = DefaultDepth(display, screen);
+        pixel_mask = visual->red_mask | visual->green_mask | visual->blue_mask;
+        bg_pixel = argb_to_int(bg_color);
+    } else {
+        // Find an opaque visual if that's all we need, otherwise an ARGB visual for transparency
+        XVisualInfo vinfo;
+        if (opaque && XMatchVisualInfo(display, screen, 24, TrueColor, &vinfo)) {
+            pixel_mask = vinfo.red_mask | vinfo.green_mask | vinfo.blue_mask;
+        } else if (!XMatchVisualInfo(display, screen, 32, TrueColor, &vinfo)) {
+            fprintf(stderr, "No ARGB visual found.\n");
+            return NULL;
+        }
 
-    // Create a colormap
-    Colormap colormap = XCreateColormap(display, root, vinfo.visual, AllocNone);
+        visual = vinfo.visual;
+        depth = vinfo.depth;
 
-    // Set window attributes
-    XSetWindowAttributes attrs;
-    attrs.colormap = colormap;
-    attrs.background_pixel = argb_to_int(bg_color);
-    attrs.border_pixel = 0;
+        // Create a colormap
+        Colormap colormap = XCreateColormap(display, root, vinfo.visual, AllocNone);
 
-    // Create the window
-    window = XCreateWindow(display, root, 0, 0, screen_width(), screen_height(), 0,
-                                  vinfo.depth, InputOutput, vinfo.visual,
-                                  CWColormap | CWBackPixel | CWBorderPixel, &attrs);
+        // Set window attributes
+        XSetWindowAttributes attrs;
+        attrs.colormap = colormap;
+        attrs.background_pixel = bg_pixel = argb_to_int(bg_color);
+        attrs.border_pixel = 0;
 
-    // Set the window type to desktop
-    Atom window_type = XInternAtom(display, "_NET_WM_WINDOW_TYPE", False);
-    Atom desktop_type = XInternAtom(display, "_NET_WM_WINDOW_TYPE_DESKTOP", False);
+        // Create the window
+        window = XCreateWindow(display, root, 0, 0, screen_width(), screen_height(), 0,
+                                      vinfo.depth, InputOutput, vinfo.visual,
+                                      CWColormap | CWBackPixel | CWBorderPixel, &attrs);
+
+        // Set the window type to desktop
+        Atom window_type = XInternAtom(display, "_NET_WM_WINDOW_TYPE", False);
+        Atom desktop_type = XInternAtom(display, "_NET_WM_WINDOW_TYPE_DESKTOP", False);
     
-    XChangeProperty(display, window, window_type, XA_ATOM, 32, PropModeReplace, (uchar*) &desktop_type, 1);
+        XChangeProperty(display, window, window_type, XA_ATOM, 32, PropModeReplace, (uchar*) &desktop_type, 1);
 
-    // Show the window
-    XMapWindow(display, window);
+        // Show the window
+        XMapWindow(display, window);
+    }
 
     // Initialize the graphics context
-    gc = XCreateGC(display, window, 0, NULL);
+    // copies from the back buffer never have anything missing, so no NoExpose events
+    XGCValues gc_values;
+    gc_values.graphics_exposures = False;
+    gc = XCreateGC(display, window, GCGraphicsExposures, &gc_values);
+
+    // Create the back buffer the scene is drawn into, starting as the background
+    buffer_width = screen_width();
+    buffer_height = screen_height();
+    back_buffer = XCreatePixmap(display, window, buffer_width, buffer_height, depth);
+    XSetForeground(display, gc, bg_pixel);
+    XFillRectangle(display, back_buffer, gc, 0, 0, buffer_width, buffer_height);
+
+    // changes are copied to the window per band of rows
+    num_bands = (buffer_height + (1 << BAND_SHIFT) - 1) >> BAND_SHIFT;
+    shown_bands = (DirtyBox*)malloc(num_bands * sizeof(DirtyBox));
+    if (shown_bands == NULL) {
+        perror("Failed to allocate memory for the back buffer bands");
+        exit(EXIT_FAILURE);
+    }
+    for (int band = 0; band < num_bands; band++) {
+        shown_bands[band] = EMPTY_BOX;
+    }
+
+    // with XFixes 2 (regions), copies get clipped to exactly what was drawn
+    int fixes_event, fixes_error, fixes_major = 0, fixes_minor = 0;
+    if (XFixesQueryExtension(display, &fixes_event, &fixes_error)
+        && XFixesQueryVersion(display, &fixes_major, &fixes_minor) && fixes_major >= 2) {
+        shown_rects = (XRectangle*)malloc(MAX_SHOWN_RECTS * sizeof(XRectangle));
+        if (shown_rects) {
+            use_regions = true;
+            copy_gc = XCreateGC(display, window, GCGraphicsExposures, &gc_values);
+            shown_extents = EMPTY_BOX;
+        }
+    }
+
+    if (root_mode) {
+        // publish the back buffer as the background and show it
+        set_root_pixmap(back_buffer);
+        XSetWindowBackgroundPixmap(display, root, back_buffer);
+        XClearWindow(display, root);
+        // the window manager owns input on the root, keybinds are grabbed separately
+        return display;
+    }
 
     // Lower the window below everything and disable input
     lower_window();
 
-    // Listen for certain events
-    XSelectInput(display, window, KeyPressMask | ButtonPressMask);
-
-    // Setup the mouse input for the window
-    XGrabPointer(display, window, True, 
-                 ButtonPressMask | ButtonReleaseMask | PointerMotionMask,
-                 GrabModeAsync, GrabModeAsync, None, None, CurrentTime);
+    // Listen for certain events, the pointer only gets grabbed in add mode
+    XSelectInput(display, window, KeyPressMask | ButtonPressMask | ExposureMask);
 
     return display;
 }
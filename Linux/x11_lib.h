@@ -8,6 +8,16 @@
 
 #include <X11/extensions/shape.h>
 #include <X11/extensions/Xrender.h>
+#include <X11/extensions/XShm.h>
+#include <X11/extensions/Xfixes.h>
+#include <X11/extensions/scrnsaver.h>
+#include <X11/extensions/dpms.h>
+#ifdef HAVE_XPRESENT
+#include <X11/extensions/Xpresent.h>
+#endif
+#ifdef HAVE_LOGIND
+#include <systemd/sd-bus.h>
+#endif
 
 #include <stdlib.h>
 #include <string.h>
@@ -18,6 +28,12 @@
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <limits.h>
+#include <time.h>
+
+#include "raster.h"
 
 /* typedefs for my convenience */
 typedef unsigned char uchar;
@@ -45,22 +61,46 @@ typedef struct POS {
 /* Function prototypes */
 void x11_cleanup();
 void fill_cell(int x, int y, size_t size);
+void fill_rect(int x, int y, int w, int h, size_t size);
 void fill_circle(int x, int y, size_t size);
+void fb_fill_cell(int x, int y, size_t size);
+void fb_fill_rect(int x, int y, int w, int h, size_t size);
+void fb_fill_circle(int x, int y, size_t size);
+bool fb_setup(bool allow_shm);
+void fb_raster(const int* cells, int board_width, int board_height,
+               const uint* palette, int num_colors, size_t size);
+void batch_fill_cell(int x, int y, size_t size);
+void batch_fill_rect(int x, int y, int w, int h, size_t size);
+void batch_fill_circle(int x, int y, size_t size);
+void flush_batches();
+void batch_setup();
+void xr_fill_cell(int x, int y, size_t size);
+void xr_fill_rect(int x, int y, int w, int h, size_t size);
+bool xr_setup(size_t size);
+void begin_frame(bool full);
+int fb_buffers();
+void present();
+bool present_setup(float fps);
+bool present_pending();
+void x11_sync();
 void color(ARGB argb);
+void color_pixel(uint pixel);
 int argb_to_int(ARGB argb);
-Display* window_setup(ARGB bg_color);
+Display* window_setup(ARGB bg_color, bool on_root, bool opaque);
 int screen_width();
 int screen_height();
 void raise_window();
 void lower_window();
 void flush();
-bool check_for_keybind(char* key);
-bool wait_for_keybind(char* key);
+void visibility_setup();
+bool window_visible();
 void setup_keybind(char* key);
+void input_handlers(void (*on_key)(char* key), void (*on_press)(POS pos));
+void grab_pointer(bool grab);
+int x11_fd();
+void x11_dispatch();
 Window* get_window();
 void focus_window();
 void unfocus_window();
-POS get_mouse_pos();
-bool is_lmb_pressed();
 
 #endif
\ No newline at end of file